@@ -8,6 +8,8 @@
 #include <nvs_flash.h>
 
 #include "HIDReportHandler.h"
+#include "LatencyTrace.h"
+#include "InputRecorder.h"
 
 static const char *TAG = "Bluetooth";
 
@@ -68,8 +70,63 @@ struct BluetoothDevInfo {
     std::map<uint16_t, GattSvc> services;
     std::vector<uint8_t>        hidReportDesc;
 
-    HIDReportHandler *reportHandlers = nullptr;
-    uint16_t          hidDataHandle  = 0;
+    // Input report characteristics, resolved once during discovery
+    struct ReportInput {
+        uint16_t valHandle  = 0;
+        uint16_t cccHandle  = 0;
+        uint16_t refHandle  = 0; // Report reference descriptor, 0 if not present
+        uint8_t  reportId   = 0;
+        bool     refRead    = false;
+        bool     subscribed = false;
+    };
+
+    HIDReportHandler        *reportHandlers = nullptr;
+    std::vector<ReportInput> reportInputs;
+
+    // GATT database hash (all zero if the device doesn't expose one)
+    uint8_t dbHash[16] = {0};
+    bool    fromCache  = false; // Report inputs taken from the GATT cache
+
+    // Connection parameter policy
+    enum class LinkMode {
+        Default,
+        Active,
+        Idle,
+    };
+    LinkMode linkMode        = LinkMode::Default;
+    bool     updatePending   = false;
+    bool     activeFallback  = false; // Peer rejected the fastest interval range
+    uint16_t connInterval    = 0;     // 1.25ms units
+    uint32_t ticksLastReport = 0;
+    uint32_t ticksRateStart  = 0;
+    uint32_t reportCount     = 0;
+    uint16_t reportRate      = 0; // Reports per second
+};
+
+// Connection parameters (interval in 1.25ms units, supervision timeout in 10ms units).
+// Peripheral latency only allows the device to skip events when it has nothing to
+// send, so it doesn't delay input reports.
+static const ble_gap_upd_params connParamsActive         = {.itvl_min = 6, .itvl_max = 12, .latency = 4, .supervision_timeout = 200, .min_ce_len = 0, .max_ce_len = 0};
+static const ble_gap_upd_params connParamsActiveFallback = {.itvl_min = 12, .itvl_max = 24, .latency = 4, .supervision_timeout = 200, .min_ce_len = 0, .max_ce_len = 0};
+static const ble_gap_upd_params connParamsIdle           = {.itvl_min = 36, .itvl_max = 48, .latency = 4, .supervision_timeout = 300, .min_ce_len = 0, .max_ce_len = 0};
+
+// Time without input reports after which the connection interval is relaxed
+#define IDLE_TIMEOUT_MS (10000)
+
+// GATT cache entry stored in NVS per bonded device, followed by the input
+// report entries and the HID report descriptor.
+#define GATT_CACHE_VERSION (1)
+struct GattCacheHeader {
+    uint8_t  version;
+    uint8_t  numInputs;
+    uint16_t descLen;
+    uint8_t  dbHash[16];
+};
+struct GattCacheInput {
+    uint16_t valHandle;
+    uint16_t cccHandle;
+    uint8_t  reportId;
+    uint8_t  reserved;
 };
 
 static bool operator<(const ble_addr_t &lhs, const ble_addr_t &rhs) {
@@ -82,6 +139,10 @@ class BluetoothInt : public Bluetooth {
     KnownDevice                            knownDevices[MAX_KNOWN_DEVICES];
     SemaphoreHandle_t                      mutex;
     std::map<ble_addr_t, BluetoothDevInfo> devices;
+    std::map<uint16_t, BluetoothDevInfo *> connDevices; // Connected devices by connection handle
+
+    // Scratch buffer for fragmented notifications (only used from the host task)
+    uint8_t rxBuf[BLE_ATT_ATTR_MAX_LEN];
 
     std::vector<ble_addr_t> tmpAddrList;
 
@@ -148,6 +209,19 @@ public:
             } else {
                 // Update RSSI
                 ble_gap_conn_rssi(bdi->connHandle, &bdi->rssi);
+
+                // Update report rate
+                auto elapsed = now - bdi->ticksRateStart;
+                if (elapsed > 0) {
+                    bdi->reportRate = (uint16_t)std::min((uint64_t)bdi->reportCount * configTICK_RATE_HZ / elapsed, (uint64_t)UINT16_MAX);
+                }
+                bdi->reportCount    = 0;
+                bdi->ticksRateStart = now;
+
+                // Relax connection interval when idle
+                if (bdi->linkMode == BluetoothDevInfo::LinkMode::Active && !bdi->reportInputs.empty() && now - bdi->ticksLastReport > pdMS_TO_TICKS(IDLE_TIMEOUT_MS)) {
+                    setLinkMode(bdi, BluetoothDevInfo::LinkMode::Idle);
+                }
             }
 
             if (remove) {
@@ -474,7 +548,18 @@ public:
             ESP_LOGE(TAG, "Error determining address type: %d", ret);
             return;
         }
-        ret = ble_gap_connect(own_addr_type, &addr, 5000, nullptr, _onGapEvent, this);
+        // Start out with a short connection interval, this also speeds up discovery
+        ble_gap_conn_params connParams = {
+            .scan_itvl           = 0x10,
+            .scan_window         = 0x10,
+            .itvl_min            = connParamsActive.itvl_min,
+            .itvl_max            = connParamsActive.itvl_max,
+            .latency             = connParamsActive.latency,
+            .supervision_timeout = connParamsActive.supervision_timeout,
+            .min_ce_len          = 0,
+            .max_ce_len          = 0,
+        };
+        ret = ble_gap_connect(own_addr_type, &addr, 5000, &connParams, _onGapEvent, this);
         if (ret != 0) {
             ESP_LOGE(TAG, "Failed to connect to device: %d", ret);
             return;
@@ -511,7 +596,17 @@ public:
                 ESP_LOGW(TAG, "Connection handle already set!");
             }
 
-            it->second.connHandle = connHandle;
+            auto bdi                = &it->second;
+            bdi->connHandle         = connHandle;
+            bdi->linkMode           = BluetoothDevInfo::LinkMode::Active;
+            bdi->updatePending      = false;
+            bdi->activeFallback     = false;
+            bdi->connInterval       = connDesc.conn_itvl;
+            bdi->ticksLastReport    = xTaskGetTickCount();
+            bdi->ticksRateStart     = bdi->ticksLastReport;
+            bdi->reportCount        = 0;
+            bdi->reportRate         = 0;
+            connDevices[connHandle] = bdi;
         }
 
         // Secure connection
@@ -529,6 +624,8 @@ public:
         ESP_LOGI(TAG, "onGapDisconnect reason=%d", reason);
         RecursiveMutexLock lock(mutex);
 
+        connDevices.erase(connDesc.conn_handle);
+
         auto it = devices.find(connDesc.peer_ota_addr);
         if (it != devices.end()) {
             auto bdi = &it->second;
@@ -536,7 +633,12 @@ public:
             bdi->ticksLastSeen = xTaskGetTickCount();
             bdi->connHandle    = -1;
             bdi->rssi          = -128;
-            bdi->hidDataHandle = 0;
+            bdi->fromCache     = false;
+            bdi->connInterval  = 0;
+            bdi->reportRate    = 0;
+            bdi->linkMode      = BluetoothDevInfo::LinkMode::Default;
+            bdi->reportInputs.clear();
+            InputRecorder::instance()->removeDevice(bdi);
 
             // Delete report handlers
             if (bdi->reportHandlers) {
@@ -564,7 +666,39 @@ public:
             ble_gap_terminate(connHandle, BLE_ERR_REM_USER_CONN_TERM);
             return;
         }
-        discoverSvcs(bdi);
+
+        // Read the database hash to see if the cached GATT info can be used
+        memset(bdi->dbHash, 0, sizeof(bdi->dbHash));
+        int ret = ble_gattc_read_by_uuid(connHandle, 1, 0xFFFF, BLE_UUID16_DECLARE(0x2b2a), _onReadDbHash, nullptr);
+        if (ret != 0) {
+            ESP_LOGE(TAG, "ble_gattc_read_by_uuid: %d", ret);
+            discoverSvcs(bdi);
+        }
+    }
+
+    static int _onReadDbHash(uint16_t connHandle, const struct ble_gatt_error *error, struct ble_gatt_attr *attr, void *arg) { return static_cast<BluetoothInt *>(getBluetooth())->onReadDbHash(connHandle, error, attr, arg); }
+
+    int onReadDbHash(uint16_t connHandle, const struct ble_gatt_error *error, struct ble_gatt_attr *attr, void *arg) {
+        RecursiveMutexLock lock(mutex);
+
+        auto bdi = getBdiFromConnHandle(connHandle);
+        if (!bdi)
+            return 0;
+
+        if (error->status == 0) {
+            if (OS_MBUF_PKTLEN(attr->om) == sizeof(bdi->dbHash))
+                os_mbuf_copydata(attr->om, 0, sizeof(bdi->dbHash), bdi->dbHash);
+            return 0;
+        }
+
+        // Done (or not supported by the device)
+        if (loadGattCache(bdi)) {
+            ESP_LOGI(TAG, "Using cached GATT info for connHandle=%d", bdi->connHandle);
+            writeCCCs(bdi);
+        } else {
+            discoverSvcs(bdi);
+        }
+        return 0;
     }
     void onGapNotifyReceived(uint16_t connHandle, uint16_t attrHandle, bool isIndication, struct os_mbuf *om) {
         // ESP_LOGI(TAG, "onGapNotifyReceived connHandle=%u attrHandle=%u", connHandle, attrHandle);
@@ -578,46 +712,116 @@ public:
             return;
         }
 
-        std::vector<uint8_t> buf;
-        auto                 size = OS_MBUF_PKTLEN(om);
-        buf.resize(size);
-        os_mbuf_copydata(om, 0, size, buf.data());
+        const BluetoothDevInfo::ReportInput *input = nullptr;
+        for (auto &ri : bdi->reportInputs) {
+            if (ri.valHandle == attrHandle) {
+                input = &ri;
+                break;
+            }
+        }
+        if (!input)
+            return;
 
-        if (attrHandle == bdi->hidDataHandle) {
-            HIDReportHandler *reportHandler = bdi->reportHandlers;
-            while (reportHandler) {
-                // FIXME: How do report Ids work in Bluetooth?
-                if (reportHandler->hasReportId)
-                    reportHandler->hasReportId = false;
+        bdi->reportCount++;
+        bdi->ticksLastReport = xTaskGetTickCount();
+        if (bdi->linkMode == BluetoothDevInfo::LinkMode::Idle)
+            setLinkMode(bdi, BluetoothDevInfo::LinkMode::Active);
 
-                reportHandler->inputReport(buf.data(), buf.size());
-                reportHandler = reportHandler->next;
-            }
+        // Use the mbuf data directly unless it is fragmented
+        const uint8_t *data = om->om_data;
+        size_t         size = OS_MBUF_PKTLEN(om);
+        if (om->om_len != size) {
+            if (size > sizeof(rxBuf) || os_mbuf_copydata(om, 0, size, rxBuf) != 0)
+                return;
+            data = rxBuf;
+        }
+
+        auto trace = LatencyTrace::instance();
+        trace->begin();
+
+        // ESP_LOG_BUFFER_HEX(TAG, data, size);
+
+        auto recorder = InputRecorder::instance();
+        if (recorder->isRecording())
+            recorder->record(bdi, bdi->hidReportDesc, input->reportId, data, size);
+
+        HIDReportHandler *reportHandler = bdi->reportHandlers;
+        while (reportHandler) {
+            reportHandler->inputReport(input->reportId, data, size);
+            reportHandler = reportHandler->next;
         }
 
-        // ESP_LOG_BUFFER_HEX(TAG, buf.data(), buf.size());
+        trace->end();
     }
     int onGapRepeatPairing(const struct ble_gap_repeat_pairing &eventInfo) {
         ESP_LOGI(TAG, "onGapRepeatPairing");
         return BLE_GAP_REPEAT_PAIRING_IGNORE; // BLE_GAP_REPEAT_PAIRING_RETRY;
     }
+    void setLinkMode(BluetoothDevInfo *bdi, BluetoothDevInfo::LinkMode mode) {
+        if (bdi->connHandle < 0 || bdi->linkMode == mode || bdi->updatePending)
+            return;
+
+        const ble_gap_upd_params *params = &connParamsIdle;
+        if (mode == BluetoothDevInfo::LinkMode::Active)
+            params = bdi->activeFallback ? &connParamsActiveFallback : &connParamsActive;
+
+        int ret = ble_gap_update_params(bdi->connHandle, params);
+        if (ret != 0) {
+            ESP_LOGE(TAG, "ble_gap_update_params: %d", ret);
+            return;
+        }
+        bdi->linkMode      = mode;
+        bdi->updatePending = true;
+    }
+
     void onGapConnUpdate(int status, uint16_t connHandle) {
         ESP_LOGI(TAG, "onGapConnUpdate status=%d connHandle=%u", status, connHandle);
+        RecursiveMutexLock lock(mutex);
+
+        auto bdi = getBdiFromConnHandle(connHandle);
+        if (!bdi)
+            return;
+
+        bool wasPending    = bdi->updatePending;
+        bdi->updatePending = false;
+
+        ble_gap_conn_desc connDesc;
+        if (ble_gap_conn_find(connHandle, &connDesc) == 0) {
+            bdi->connInterval = connDesc.conn_itvl;
+            ESP_LOGI(TAG, "Connection interval %u.%02ums latency %u", connDesc.conn_itvl * 5 / 4, (connDesc.conn_itvl * 125) % 100, connDesc.conn_latency);
+        }
+
+        if (status != 0 && wasPending && bdi->linkMode == BluetoothDevInfo::LinkMode::Active && !bdi->activeFallback) {
+            // Peer doesn't support the fastest interval range, retry with a slower one
+            bdi->activeFallback = true;
+            bdi->linkMode       = BluetoothDevInfo::LinkMode::Default;
+            setLinkMode(bdi, BluetoothDevInfo::LinkMode::Active);
+        }
     }
     void onGapConnUpdateReq(const struct ble_gap_upd_params *peerParams, struct ble_gap_upd_params *selfParams, uint16_t connHandle) {
-        ESP_LOGI(TAG, "onGapConnUpdateReq");
-        if (selfParams->itvl_min < 24) { // 1.25ms units
-            selfParams->itvl_min = 24;
-        } else if (selfParams->itvl_max > 40) { // 1.25ms units
-            selfParams->itvl_min = 40;
-        } else if (selfParams->latency > 2) { // Number of intervals allowed to skip
-            selfParams->latency = 2;
-        } else if (selfParams->supervision_timeout > 100) { // 10ms units
-            selfParams->supervision_timeout = 100;
-        }
+        ESP_LOGI(
+            TAG, "onGapConnUpdateReq itvl=%u-%u latency=%u timeout=%u",
+            peerParams->itvl_min, peerParams->itvl_max, peerParams->latency, peerParams->supervision_timeout);
+        RecursiveMutexLock lock(mutex);
+
+        // Accept the range the peer supports, but pick the shortest interval in it while active
+        *selfParams          = *peerParams;
+        selfParams->itvl_min = std::max(peerParams->itvl_min, connParamsActive.itvl_min);
+        selfParams->itvl_max = std::max(peerParams->itvl_max, selfParams->itvl_min);
+        selfParams->latency  = std::min(peerParams->latency, connParamsActive.latency);
+
+        auto bdi = getBdiFromConnHandle(connHandle);
+        if (bdi && bdi->linkMode != BluetoothDevInfo::LinkMode::Idle)
+            selfParams->itvl_max = selfParams->itvl_min;
+
+        // Supervision timeout should cover a few (latency + 1) * interval periods
+        uint32_t minTimeout = (1 + selfParams->latency) * selfParams->itvl_max * 125 * 4 / 1000 + 1; // 10ms units
+        if (selfParams->supervision_timeout < minTimeout)
+            selfParams->supervision_timeout = std::min(minTimeout, (uint32_t)3200);
     }
     void onGapL2CapUpdateReq(const struct ble_gap_upd_params *peerParams, struct ble_gap_upd_params *selfParams, uint16_t connHandle) {
         ESP_LOGI(TAG, "onGapL2CapUpdateReq");
+        onGapConnUpdateReq(peerParams, selfParams, connHandle);
     }
     void onGapPairingComplete(int status, uint16_t connHandle) {
         ESP_LOGI(TAG, "onGapPairingComplete status=%d connHandle=%u", status, connHandle);
@@ -638,20 +842,32 @@ public:
 #endif
 
     BluetoothDevInfo *getBdiFromConnHandle(uint16_t connHandle) {
-        ble_gap_conn_desc connDesc;
-        if (ble_gap_conn_find(connHandle, &connDesc) != 0) {
+        auto it = connDevices.find(connHandle);
+        if (it == connDevices.end()) {
             return nullptr;
         }
-
-        auto it = devices.find(connDesc.peer_ota_addr);
-        if (it == devices.end()) {
-            return nullptr;
-        }
-        return &it->second;
+        return it->second;
     }
 
-    static int _onGattAttrWritten(uint16_t connHandle, const struct ble_gatt_error *error, struct ble_gatt_attr *attr, void *arg) {
+    static int _onGattAttrWritten(uint16_t connHandle, const struct ble_gatt_error *error, struct ble_gatt_attr *attr, void *arg) { return static_cast<BluetoothInt *>(getBluetooth())->onGattAttrWritten(connHandle, error, attr, arg); }
+    static int _onReadReportRef(uint16_t connHandle, const struct ble_gatt_error *error, struct ble_gatt_attr *attr, void *arg) { return static_cast<BluetoothInt *>(getBluetooth())->onReadReportRef(connHandle, error, attr, arg); }
+
+    int onGattAttrWritten(uint16_t connHandle, const struct ble_gatt_error *error, struct ble_gatt_attr *attr, void *arg) {
         ESP_LOGI(TAG, "_onGattAttrWritten connHandle=%u status=%u att_handle=%u", connHandle, error->status, error->att_handle);
+        RecursiveMutexLock lock(mutex);
+
+        auto bdi = getBdiFromConnHandle(connHandle);
+        if (!bdi)
+            return 0;
+
+        if (error->status != 0 && bdi->fromCache) {
+            // Cached handles are stale, rediscover on next connect
+            ESP_LOGW(TAG, "Cached GATT info invalid, dropping it");
+            eraseGattCache(bdi->addr);
+            ble_gap_terminate(connHandle, BLE_ERR_REM_USER_CONN_TERM);
+            return 0;
+        }
+        writeCCCs(bdi);
         return 0;
     }
 
@@ -690,31 +906,93 @@ public:
 
             bdi->reportHandlers = HIDReportHandler::getReportHandlersForDescriptor(bdi->hidReportDesc.data(), bdi->hidReportDesc.size());
 
-            writeCCCs(bdi);
+            collectReportInputs(bdi);
+            readReportRefs(bdi);
         }
         return 0;
     }
 
-    void writeCCCs(BluetoothDevInfo *bdi) {
+    void collectReportInputs(BluetoothDevInfo *bdi) {
+        bdi->reportInputs.clear();
+
         for (auto &[key, svc] : bdi->services) {
             for (auto &[key, chr] : svc.chrs) {
+                if (chr.chr.uuid.u.type != BLE_UUID_TYPE_16 || chr.chr.uuid.u16.value != 0x2a4d || // Report
+                    (chr.chr.properties & BLE_GATT_CHR_PROP_NOTIFY) == 0)                          // Input report
+                    continue;
+
+                BluetoothDevInfo::ReportInput ri;
+                ri.valHandle = chr.chr.val_handle;
+
                 for (auto &[key, dsc] : chr.dscs) {
-                    if (chr.chr.uuid.u.type == BLE_UUID_TYPE_16 && chr.chr.uuid.u16.value == 0x2a4d && // Report
-                        (chr.chr.properties & 0x10) != 0 &&                                            // Indication?
-                        dsc.dsc.uuid.u.type == BLE_UUID_TYPE_16 && dsc.dsc.uuid.u16.value == 0x2902) { // CCC descriptor
-
-                        if (bdi->hidDataHandle == 0) {
-                            bdi->hidDataHandle = chr.chr.val_handle;
-
-                            uint16_t value = 1; // Enable indication
-                            int      ret   = ble_gattc_write_flat(bdi->connHandle, dsc.dsc.handle, &value, sizeof(value), _onGattAttrWritten, nullptr);
-                            if (ret != 0) {
-                                ESP_LOGE(TAG, "ble_gattc_write_flat: %d", ret);
-                            }
-                        }
-                    }
+                    if (dsc.dsc.uuid.u.type != BLE_UUID_TYPE_16)
+                        continue;
+                    if (dsc.dsc.uuid.u16.value == 0x2902) // CCC descriptor
+                        ri.cccHandle = dsc.dsc.handle;
+                    else if (dsc.dsc.uuid.u16.value == 0x2908) // Report reference descriptor
+                        ri.refHandle = dsc.dsc.handle;
                 }
+                if (ri.cccHandle)
+                    bdi->reportInputs.push_back(ri);
+            }
+        }
+    }
+
+    // Read the report ID of each input report, one at a time
+    void readReportRefs(BluetoothDevInfo *bdi) {
+        for (auto &ri : bdi->reportInputs) {
+            if (ri.refHandle == 0 || ri.refRead)
+                continue;
+
+            int ret = ble_gattc_read(bdi->connHandle, ri.refHandle, _onReadReportRef, nullptr);
+            if (ret != 0) {
+                ESP_LOGE(TAG, "ble_gattc_read: %d", ret);
+                ri.refRead = true;
+                continue;
+            }
+            return;
+        }
+        saveGattCache(bdi);
+        writeCCCs(bdi);
+    }
+
+    int onReadReportRef(uint16_t connHandle, const struct ble_gatt_error *error, struct ble_gatt_attr *attr, void *arg) {
+        RecursiveMutexLock lock(mutex);
+
+        auto bdi = getBdiFromConnHandle(connHandle);
+        if (!bdi)
+            return 0;
+
+        for (auto &ri : bdi->reportInputs) {
+            if (ri.refHandle == 0 || ri.refRead)
+                continue;
+
+            ri.refRead = true;
+            uint8_t ref[2];
+            if (error->status == 0 && os_mbuf_copydata(attr->om, 0, sizeof(ref), ref) == 0) {
+                ri.reportId = ref[0];
+                ESP_LOGI(TAG, "Input report handle=%u reportId=%u", ri.valHandle, ri.reportId);
             }
+            break;
+        }
+        readReportRefs(bdi);
+        return 0;
+    }
+
+    // Enable notifications of the input reports, one at a time
+    void writeCCCs(BluetoothDevInfo *bdi) {
+        for (auto &ri : bdi->reportInputs) {
+            if (ri.subscribed)
+                continue;
+
+            ri.subscribed  = true;
+            uint16_t value = 1; // Enable notification
+            int      ret   = ble_gattc_write_flat(bdi->connHandle, ri.cccHandle, &value, sizeof(value), _onGattAttrWritten, nullptr);
+            if (ret != 0) {
+                ESP_LOGE(TAG, "ble_gattc_write_flat: %d", ret);
+                continue;
+            }
+            return;
         }
     }
 
@@ -1048,6 +1326,115 @@ public:
         }
     }
 
+    static void getGattCacheKey(char key[16], const ble_addr_t &addr) {
+        snprintf(
+            key, 16, "gc%02x%02x%02x%02x%02x%02x%x",
+            addr.val[5], addr.val[4], addr.val[3], addr.val[2], addr.val[1], addr.val[0], addr.type & 0xF);
+    }
+
+    bool loadGattCache(BluetoothDevInfo *bdi) {
+        char key[16];
+        getGattCacheKey(key, bdi->addr);
+
+        std::vector<uint8_t> blob;
+        nvs_handle_t         h;
+        if (nvs_open("bt_settings", NVS_READONLY, &h) != ESP_OK)
+            return false;
+
+        size_t len = 0;
+        if (nvs_get_blob(h, key, nullptr, &len) == ESP_OK && len >= sizeof(GattCacheHeader)) {
+            blob.resize(len);
+            if (nvs_get_blob(h, key, blob.data(), &len) != ESP_OK)
+                blob.clear();
+        }
+        nvs_close(h);
+
+        if (blob.empty())
+            return false;
+
+        GattCacheHeader hdr;
+        memcpy(&hdr, blob.data(), sizeof(hdr));
+        if (hdr.version != GATT_CACHE_VERSION ||
+            blob.size() != sizeof(hdr) + hdr.numInputs * sizeof(GattCacheInput) + hdr.descLen ||
+            hdr.numInputs == 0 || hdr.descLen == 0)
+            return false;
+
+        if (memcmp(hdr.dbHash, bdi->dbHash, sizeof(hdr.dbHash)) != 0) {
+            ESP_LOGI(TAG, "GATT database hash changed");
+            return false;
+        }
+
+        const uint8_t *p = blob.data() + sizeof(hdr);
+        bdi->reportInputs.clear();
+        for (unsigned i = 0; i < hdr.numInputs; i++, p += sizeof(GattCacheInput)) {
+            GattCacheInput ci;
+            memcpy(&ci, p, sizeof(ci));
+
+            BluetoothDevInfo::ReportInput ri;
+            ri.valHandle = ci.valHandle;
+            ri.cccHandle = ci.cccHandle;
+            ri.reportId  = ci.reportId;
+            ri.refRead   = true;
+            bdi->reportInputs.push_back(ri);
+        }
+        bdi->hidReportDesc.assign(p, p + hdr.descLen);
+
+        if (bdi->reportHandlers)
+            delete bdi->reportHandlers;
+        bdi->reportHandlers = HIDReportHandler::getReportHandlersForDescriptor(bdi->hidReportDesc.data(), bdi->hidReportDesc.size());
+        bdi->fromCache      = true;
+        return true;
+    }
+
+    void saveGattCache(BluetoothDevInfo *bdi) {
+        bdi->fromCache = false;
+        if (bdi->reportInputs.empty() || bdi->hidReportDesc.empty() || findKnownDevice(bdi->addr) < 0)
+            return;
+
+        GattCacheHeader hdr;
+        hdr.version   = GATT_CACHE_VERSION;
+        hdr.numInputs = (uint8_t)std::min(bdi->reportInputs.size(), (size_t)255);
+        hdr.descLen   = (uint16_t)bdi->hidReportDesc.size();
+        memcpy(hdr.dbHash, bdi->dbHash, sizeof(hdr.dbHash));
+
+        std::vector<uint8_t> blob(sizeof(hdr) + hdr.numInputs * sizeof(GattCacheInput));
+        memcpy(blob.data(), &hdr, sizeof(hdr));
+        for (unsigned i = 0; i < hdr.numInputs; i++) {
+            auto          &ri = bdi->reportInputs[i];
+            GattCacheInput ci;
+            ci.valHandle = ri.valHandle;
+            ci.cccHandle = ri.cccHandle;
+            ci.reportId  = ri.reportId;
+            ci.reserved  = 0;
+            memcpy(blob.data() + sizeof(hdr) + i * sizeof(ci), &ci, sizeof(ci));
+        }
+        blob.insert(blob.end(), bdi->hidReportDesc.begin(), bdi->hidReportDesc.end());
+
+        char key[16];
+        getGattCacheKey(key, bdi->addr);
+
+        nvs_handle_t h;
+        if (nvs_open("bt_settings", NVS_READWRITE, &h) == ESP_OK) {
+            if (nvs_set_blob(h, key, blob.data(), blob.size()) == ESP_OK) {
+                nvs_commit(h);
+            }
+            nvs_close(h);
+        }
+    }
+
+    void eraseGattCache(const ble_addr_t &addr) {
+        char key[16];
+        getGattCacheKey(key, addr);
+
+        nvs_handle_t h;
+        if (nvs_open("bt_settings", NVS_READWRITE, &h) == ESP_OK) {
+            if (nvs_erase_key(h, key) == ESP_OK) {
+                nvs_commit(h);
+            }
+            nvs_close(h);
+        }
+    }
+
     bool addDevice(const BleAddr &_addr, const std::string &name) override {
         ESP_LOGW(TAG, "addDevice %s '%s'", toString(*reinterpret_cast<const ble_addr_t *>(&_addr)).c_str(), name.c_str());
 
@@ -1108,11 +1495,15 @@ public:
                         ESP_LOGE(TAG, "Error disconnecting device: %d", ret);
                     }
                 }
+                connDevices.erase(it->second.connHandle);
                 it->second.connHandle = -1;
             }
+            InputRecorder::instance()->removeDevice(&it->second);
             devices.erase(it);
         }
 
+        eraseGattCache(addr);
+
         // Remove from BLE store
         if (enabled) {
             auto ret = ble_store_util_delete_peer(&addr);
@@ -1154,6 +1545,9 @@ public:
             btdi.appearance = dev.appearance;
             btdi.rssi       = dev.rssi;
 
+            btdi.connInterval = dev.connInterval;
+            btdi.reportRate   = dev.reportRate;
+
             if (dev.connHandle >= 0) {
                 result.connectedDevices.push_back(btdi);
             } else {
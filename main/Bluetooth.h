@@ -12,6 +12,10 @@ struct BtDevInfo {
     std::string name;
     uint16_t    appearance = 0;
     int8_t      rssi       = -128;
+
+    // Only valid when connected
+    uint16_t connInterval = 0; // 1.25ms units
+    uint16_t reportRate   = 0; // Input reports per second
 };
 
 struct BluetoothInfo {
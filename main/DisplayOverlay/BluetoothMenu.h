@@ -32,6 +32,14 @@ public:
                 items.emplace_back(MenuItemType::subMenu, (const char *)str);
             }
         }
+        if (bdi.connInterval > 0) {
+            char str[32];
+            snprintf(str, sizeof(str), "Interval: %u.%02ums", bdi.connInterval * 5 / 4, (bdi.connInterval * 125) % 100);
+            items.emplace_back(MenuItemType::subMenu, (const char *)str);
+
+            snprintf(str, sizeof(str), "Report rate: %u/s", bdi.reportRate);
+            items.emplace_back(MenuItemType::subMenu, (const char *)str);
+        }
 
         items.emplace_back(MenuItemType::separator);
 
@@ -56,6 +64,7 @@ class BluetoothMenu : public Menu {
 
 public:
     BluetoothMenu() : Menu("Bluetooth", 38) {
+        tickInterval = 1000;
     }
 
     MenuItem &addNetworkItem(const BtDevInfo &info) {
@@ -1,6 +1,7 @@
 #include "DisplayOverlay.h"
 #include "FPGA.h"
 #include "Menus.h"
+#include <algorithm>
 
 #ifndef EMULATOR
 extern const uint8_t ovlFontStart[] asm("_binary_ovl_font_chr_start");
@@ -8,11 +9,17 @@ extern const uint8_t ovlFontStart[] asm("_binary_ovl_font_chr_start");
 #include "ovl_font.h"
 #endif
 
+// Rows in text buffer, the last row is only partially used
+#define NUM_ROWS ((1024 + 39) / 40)
+
 class DisplayOverlayInt : public DisplayOverlay {
 public:
     bool          overlayVisible = false;
     Menu         *currentMenu    = nullptr;
     uint16_t      textBuf[1024];
+    uint16_t      sentBuf[1024];
+    uint32_t      dirtyRows   = 0;
+    bool          sentValid   = false;
     uint16_t      palette[16] = {0xF111, 0xFF11, 0xF1F1, 0xFFF1, 0xF22E, 0xFF1F, 0xF3CC, 0xFFFF, 0xFCCC, 0xF3BB, 0xFC2C, 0xF419, 0xFFF7, 0xF2D4, 0xFB22, 0x0333};
     volatile bool doReinit    = false;
     bool          initialized = false;
@@ -31,10 +38,16 @@ public:
 
     static void _task(void *param) { static_cast<DisplayOverlayInt *>(param)->task(); }
 
+    void markDirty(int y, int h = 1) {
+        for (int row = std::max(y, 0); row < std::min(y + h, NUM_ROWS); row++)
+            dirtyRows |= (1 << row);
+    }
+
     void clearScreen() override {
         for (int i = 0; i < 1024; i++) {
             textBuf[i] = 0xFF00;
         }
+        markDirty(0, NUM_ROWS);
     }
 
     void drawBorder(int x, int y, int w, int h, unsigned colBorder, unsigned colFill, int selectedRow, unsigned colFillSel) override {
@@ -42,6 +55,7 @@ public:
         uint16_t colSelected = makeAttr(colBorder, colFillSel) << 8;
 
         uint16_t *p = &textBuf[y * 40 + x];
+        markDirty(y, h);
 
         // Top border
         {
@@ -81,6 +95,7 @@ public:
             *(pd++) = (attr << 8) | *ps;
             ps++;
         }
+        markDirty(y, (x + (int)(ps - str) + 39) / 40);
     }
 
     void drawFmt(int x, int y, uint8_t attr, const char *fmt, ...) override {
@@ -94,6 +109,7 @@ public:
 
     void fill(int x, int y, int w, int h, uint8_t attr, uint8_t ch) override {
         uint16_t *pd = &textBuf[y * 40 + x];
+        markDirty(y, h);
 
         for (int j = 0; j < h; j++) {
             auto pd2 = pd;
@@ -105,6 +121,7 @@ public:
 
     void setAttr(int x, int y, uint8_t attr) override {
         textBuf[y * 40 + x] = (attr << 8) | (textBuf[y * 40 + x] & 0xFF);
+        markDirty(y);
     }
 
     void setVisible(bool show) override {
@@ -119,11 +136,33 @@ public:
     }
 
     void render() override {
-        FPGA::instance()->setOverlayText(textBuf);
+        // Menus redraw the whole screen, so compare the touched rows with what
+        // was uploaded last. The text command always starts at the first
+        // character, so upload up to and including the last changed row.
+        int lastRow = -1;
+        for (int row = NUM_ROWS - 1; row >= 0 && lastRow < 0; row--) {
+            if (!sentValid)
+                lastRow = row;
+            else if ((dirtyRows & (1 << row)) && memcmp(&textBuf[row * 40], &sentBuf[row * 40], rowBytes(row)) != 0)
+                lastRow = row;
+        }
+        dirtyRows = 0;
+        if (lastRow < 0)
+            return;
+
+        size_t count = std::min(1024, (lastRow + 1) * 40);
+        memcpy(sentBuf, textBuf, count * sizeof(textBuf[0]));
+        sentValid = true;
+        FPGA::instance()->setOverlayText(textBuf, count);
+    }
+
+    static size_t rowBytes(int row) {
+        return std::min(40, 1024 - row * 40) * sizeof(textBuf[0]);
     }
 
     void reinit() override {
         doReinit = true;
+        Menu::notifyChanged();
     }
 
     bool shouldReinit() override {
@@ -134,8 +173,9 @@ public:
         while (1) {
             doReinit = false;
 
-            // Load font
+            // Load font, the FPGA might have been reconfigured so upload all text on next render
             FPGA::instance()->setOverlayFont(ovlFontStart);
+            sentValid = false;
 
             overlayVisible = false;
             setVisible(overlayVisible);
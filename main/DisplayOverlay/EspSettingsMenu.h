@@ -3,6 +3,7 @@
 #include "Menu.h"
 #include "KeyboardLayoutMenu.h"
 #include "Keyboard.h"
+#include "InputRecordMenu.h"
 #ifndef EMULATOR
 #include "WiFiMenu.h"
 #include "BluetoothMenu.h"
@@ -119,6 +120,15 @@ public:
                 subMenu.show();
             };
         }
+#else
+        items.emplace_back(MenuItemType::separator);
 #endif
+        {
+            auto &item   = items.emplace_back(MenuItemType::subMenu, "Input recording");
+            item.onEnter = [&]() {
+                InputRecordMenu subMenu;
+                subMenu.show();
+            };
+        }
     }
 };
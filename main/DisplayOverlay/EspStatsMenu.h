@@ -1,59 +1,91 @@
 #pragma once
 
 #include "Menu.h"
+#include "LatencyTrace.h"
 #include <esp_heap_caps.h>
 
 class EspStatsMenu : public Menu {
 public:
     EspStatsMenu() : Menu("ESP stats", 38) {
+        tickInterval = 1000;
     }
 
-    void onUpdate() override {
+    std::vector<MenuItem> getStats() {
+        std::vector<MenuItem> result;
+
         multi_heap_info_t info;
         heap_caps_get_info(&info, MALLOC_CAP_DEFAULT);
 
-        setNeedsRedraw();
-        items.clear();
-
-        items.emplace_back(MenuItemType::separator, "Memory");
+        result.emplace_back(MenuItemType::separator, "Memory");
         char tmp[40];
         snprintf(tmp, sizeof(tmp), "Total              %7u bytes", (unsigned)(info.total_free_bytes + info.total_allocated_bytes));
-        items.emplace_back(MenuItemType::subMenu, tmp);
+        result.emplace_back(MenuItemType::subMenu, tmp);
         snprintf(tmp, sizeof(tmp), "Free               %7u bytes", (unsigned)info.total_free_bytes);
-        items.emplace_back(MenuItemType::subMenu, tmp);
+        result.emplace_back(MenuItemType::subMenu, tmp);
         snprintf(tmp, sizeof(tmp), "Allocated          %7u bytes", (unsigned)info.total_allocated_bytes);
-        items.emplace_back(MenuItemType::subMenu, tmp);
+        result.emplace_back(MenuItemType::subMenu, tmp);
         snprintf(tmp, sizeof(tmp), "Largest free       %7u bytes", (unsigned)info.largest_free_block);
-        items.emplace_back(MenuItemType::subMenu, tmp);
+        result.emplace_back(MenuItemType::subMenu, tmp);
         snprintf(tmp, sizeof(tmp), "Minimum free       %7u bytes", (unsigned)info.minimum_free_bytes);
-        items.emplace_back(MenuItemType::subMenu, tmp);
+        result.emplace_back(MenuItemType::subMenu, tmp);
         snprintf(tmp, sizeof(tmp), "Allocated blocks   %7u", (unsigned)info.allocated_blocks);
-        items.emplace_back(MenuItemType::subMenu, tmp);
+        result.emplace_back(MenuItemType::subMenu, tmp);
         snprintf(tmp, sizeof(tmp), "Free blocks        %7u", (unsigned)info.free_blocks);
-        items.emplace_back(MenuItemType::subMenu, tmp);
+        result.emplace_back(MenuItemType::subMenu, tmp);
         snprintf(tmp, sizeof(tmp), "Total blocks       %7u", (unsigned)info.total_blocks);
-        items.emplace_back(MenuItemType::subMenu, tmp);
+        result.emplace_back(MenuItemType::subMenu, tmp);
 
         nvs_stats_t stats;
         if (nvs_get_stats(nullptr, &stats) == ESP_OK) {
-            items.emplace_back(MenuItemType::separator);
-            items.emplace_back(MenuItemType::separator, "NVS");
+            result.emplace_back(MenuItemType::separator);
+            result.emplace_back(MenuItemType::separator, "NVS");
 
             snprintf(tmp, sizeof(tmp), "Used entries       %7u", stats.used_entries);
-            items.emplace_back(MenuItemType::subMenu, tmp);
+            result.emplace_back(MenuItemType::subMenu, tmp);
             snprintf(tmp, sizeof(tmp), "Free entries       %7u", stats.free_entries);
-            items.emplace_back(MenuItemType::subMenu, tmp);
+            result.emplace_back(MenuItemType::subMenu, tmp);
             snprintf(tmp, sizeof(tmp), "Available entries  %7u", stats.available_entries);
-            items.emplace_back(MenuItemType::subMenu, tmp);
+            result.emplace_back(MenuItemType::subMenu, tmp);
             snprintf(tmp, sizeof(tmp), "Total entries      %7u", stats.total_entries);
-            items.emplace_back(MenuItemType::subMenu, tmp);
+            result.emplace_back(MenuItemType::subMenu, tmp);
             snprintf(tmp, sizeof(tmp), "Namespace count    %7u", stats.namespace_count);
-            items.emplace_back(MenuItemType::subMenu, tmp);
+            result.emplace_back(MenuItemType::subMenu, tmp);
+        }
+
+        {
+            result.emplace_back(MenuItemType::separator);
+            result.emplace_back(MenuItemType::separator, "Input latency (us)   p50   p99   max");
+
+            auto trace = LatencyTrace::instance();
+            for (int i = 0; i < (int)TracePoint::Count; i++) {
+                auto stats = trace->getStats((TracePoint)i);
+                snprintf(tmp, sizeof(tmp), "%-18s%6u%6u%6u", trace->getName((TracePoint)i), stats.p50, stats.p99, stats.max);
+                result.emplace_back(MenuItemType::subMenu, tmp);
+            }
         }
+        return result;
+    }
+
+    void onUpdate() override {
+        setNeedsRedraw();
+        items = getStats();
     }
 
     bool onTick() override {
-        setNeedsUpdate();
-        return false;
+        // Update item text in place, only redraw when a value changed
+        auto stats = getStats();
+        if (stats.size() != items.size()) {
+            items = std::move(stats);
+            return true;
+        }
+
+        bool changed = false;
+        for (size_t i = 0; i < items.size(); i++) {
+            if (items[i].name != stats[i].name) {
+                items[i].name = std::move(stats[i].name);
+                changed       = true;
+            }
+        }
+        return changed;
     }
 };
@@ -4,14 +4,24 @@
 #include "Keyboard.h"
 #include "GameCtrl.h"
 #include "VFS.h"
+#include <algorithm>
 
+// File list that only materializes the visible rows: entries are kept in the
+// directory enumeration context and items are created on demand by getItem().
 class FileListMenu : public Menu {
 public:
     std::string                              path;
     std::function<void(const std::string &)> onSelect;
     DirEnumCtx                               ctx;
+    std::vector<uint32_t>                    files; // Indices into ctx, sorted by name
 
     FileListMenu() : Menu("", 38) {
+        fileItem.onEnter = [this]() {
+            if (files.empty())
+                return;
+            setExitMenu();
+            onSelect(path + '/' + getEntry(selectedRow).filename);
+        };
     }
 
     bool    enabled            = false;
@@ -19,27 +29,63 @@ public:
 
     void onUpdate() override {
         items.clear();
+        files.clear();
+        search.clear();
 
         auto vfs     = getSDCardVFS();
         auto entries = vfs->direnum(path, 0);
         if (entries.first == 0) {
             ctx = entries.second;
 
-            for (auto &entry : *ctx) {
-                if (entry.attr & DE_ATTR_DIR)
-                    continue;
-
-                std::string *fileName = &entry.filename;
-                auto        &item     = items.emplace_back(MenuItemType::subMenu, *fileName);
-                item.onEnter          = [this, fileName]() {
-                    setExitMenu();
-                    onSelect(path + '/' + *fileName);
-                };
+            for (uint32_t i = 0; i < ctx->size(); i++) {
+                if (((*ctx)[i].attr & DE_ATTR_DIR) == 0)
+                    files.push_back(i);
             }
+            std::sort(files.begin(), files.end(), [this](uint32_t a, uint32_t b) {
+                return strcasecmp((*ctx)[a].filename.c_str(), (*ctx)[b].filename.c_str()) < 0;
+            });
         }
 
-        if (items.empty()) {
+        if (files.empty()) {
             items.emplace_back(MenuItemType::onOff, "No presets found");
         }
     }
+
+    int getItemCount() override {
+        return files.empty() ? (int)items.size() : (int)files.size();
+    }
+
+    MenuItem &getItem(int idx) override {
+        if (files.empty())
+            return items[idx];
+
+        fileItem.name = getEntry(idx).filename;
+        return fileItem;
+    }
+
+    void onKey(int ch) override {
+        if (ch < ' ' || ch > '~' || files.empty())
+            return;
+
+        // Typed characters within a second extend the search string
+        auto curTicks = xTaskGetTickCount();
+        if (curTicks - lastSearchTicks > pdMS_TO_TICKS(1000))
+            search.clear();
+        lastSearchTicks = curTicks;
+        search.push_back(ch);
+
+        // Jump to first entry starting with the search string
+        auto it = std::lower_bound(files.begin(), files.end(), search, [this](uint32_t a, const std::string &s) {
+            return strncasecmp((*ctx)[a].filename.c_str(), s.c_str(), s.size()) < 0;
+        });
+        if (it != files.end() && strncasecmp((*ctx)[*it].filename.c_str(), search.c_str(), search.size()) == 0)
+            selectedRow = (int)(it - files.begin());
+    }
+
+private:
+    DirEnumEntry &getEntry(int idx) { return (*ctx)[files[idx]]; }
+
+    MenuItem    fileItem{MenuItemType::subMenu};
+    std::string search;
+    TickType_t  lastSearchTicks = 0;
 };
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Menu.h"
+#include "FileListMenu.h"
+#include "DisplayOverlay.h"
+#include "InputRecorder.h"
+
+class InputRecordMenu : public Menu {
+public:
+    InputRecordMenu() : Menu("Input recording", 38) {
+    }
+
+    static constexpr const char *recPath = "/config/esp32/input";
+
+    bool                       hasResult = false;
+    int                        result    = 0;
+    InputRecorder::ReplayStats stats;
+
+    void replay(const std::string &path) {
+        auto ovl = getDisplayOverlay();
+
+        // Hide overlay, otherwise key presses don't reach the core
+        ovl->setVisible(false);
+        result    = InputRecorder::instance()->replay(path, stats);
+        hasResult = true;
+        ovl->setVisible(true);
+
+        // Discard keys typed by the replay
+        while (Keyboard::instance()->getKey(0) >= 0) {
+        }
+    }
+
+    void onUpdate() override {
+        items.clear();
+        {
+            auto &item  = items.emplace_back(MenuItemType::onOff, "Record input");
+            item.setter = [this](int newVal) {
+                auto recorder = InputRecorder::instance();
+                if (newVal) {
+                    recorder->startRecording();
+                } else if (recorder->hasRecording()) {
+                    std::string name;
+                    bool        save = editString(recorder->isRecording() ? "Enter recording name" : "Buffer full, enter recording name", name, 32);
+                    name             = trim(name, " \t\n\r\f\v/\\");
+
+                    if (save && !name.empty() && createPath(recPath)) {
+                        if (recorder->stopRecording(std::string(recPath) + "/" + name) < 0) {
+                            drawMessage("Error saving recording");
+                            vTaskDelay(pdMS_TO_TICKS(2000));
+                        }
+                    } else {
+                        recorder->stopRecording("");
+                    }
+                }
+                setNeedsUpdate();
+            };
+            item.getter = []() { return InputRecorder::instance()->hasRecording() ? 1 : 0; };
+        }
+        {
+            auto &item   = items.emplace_back(MenuItemType::subMenu, "Replay recording");
+            item.onEnter = [this]() {
+                FileListMenu menu;
+                menu.title    = "Select recording";
+                menu.path     = recPath;
+                menu.onSelect = [this](const std::string &path) { replay(path); };
+                menu.show();
+                setNeedsUpdate();
+            };
+        }
+
+        if (hasResult) {
+            items.emplace_back(MenuItemType::separator);
+            items.emplace_back(MenuItemType::separator, "Last replay");
+
+            char tmp[40];
+            if (result < 0) {
+                snprintf(tmp, sizeof(tmp), "Error %d", result);
+                items.emplace_back(MenuItemType::subMenu, tmp);
+            } else {
+                snprintf(tmp, sizeof(tmp), "Reports            %7u", stats.reports);
+                items.emplace_back(MenuItemType::subMenu, tmp);
+                snprintf(tmp, sizeof(tmp), "Events             %7u", stats.events);
+                items.emplace_back(MenuItemType::subMenu, tmp);
+                snprintf(tmp, sizeof(tmp), "CPU/report p50     %7u us", stats.p50);
+                items.emplace_back(MenuItemType::subMenu, tmp);
+                snprintf(tmp, sizeof(tmp), "CPU/report p99     %7u us", stats.p99);
+                items.emplace_back(MenuItemType::subMenu, tmp);
+                snprintf(tmp, sizeof(tmp), "CPU/report max     %7u us", stats.max);
+                items.emplace_back(MenuItemType::subMenu, tmp);
+            }
+        }
+    }
+};
@@ -6,7 +6,7 @@ void Menu::draw() {
     auto ovl = getDisplayOverlay();
     ovl->clearScreen();
 
-    int numRows     = (int)items.size();
+    int numRows     = getItemCount();
     int x           = (40 - width) / 2;
     int height      = getHeight();
     int y           = (25 - height) / 2;
@@ -26,7 +26,7 @@ void Menu::draw() {
 
     {
         int selRow = selectedRow;
-        if (selRow >= 0 && items[selRow].type == MenuItemType::separator)
+        if (selRow >= 0 && getItem(selRow).type == MenuItemType::separator)
             selRow = -1;
         else {
             selRow -= firstRow;
@@ -57,7 +57,7 @@ void Menu::draw() {
     for (int i = firstRow, j = 0; i < numRows && j < visibleRows; i++, j++, y++) {
         auto attr = (selectedRow == i) ? attrSelected : attrNormal;
 
-        auto &mi = items[i];
+        auto &mi = getItem(i);
         if (mi.type == MenuItemType::separator && mi.name.empty())
             continue;
 
@@ -131,13 +131,6 @@ void Menu::show() {
     while (!exitMenu && !getDisplayOverlay()->shouldReinit()) {
         bool ovlVisible = ovl->isVisible();
 
-        auto curTicks = xTaskGetTickCount();
-        if (curTicks - prevTicks > pdMS_TO_TICKS(1000)) {
-            if (ovlVisible)
-                needsRedraw |= onTick();
-            prevTicks = curTicks;
-        }
-
         if (needsUpdate) {
             onUpdate();
             needsUpdate = false;
@@ -145,9 +138,9 @@ void Menu::show() {
 
         // Make sure selectedRow is valid
         {
-            selectedRow = items.empty() ? -1 : (std::min(std::max(selectedRow, 0), (int)items.size() - 1));
+            selectedRow = getItemCount() == 0 ? -1 : (std::min(std::max(selectedRow, 0), getItemCount() - 1));
 
-            while (selectedRow < (int)items.size() - 1 && items[selectedRow].type == MenuItemType::separator) {
+            while (selectedRow < getItemCount() - 1 && getItem(selectedRow).type == MenuItemType::separator) {
                 selectedRow++;
             }
         }
@@ -157,8 +150,26 @@ void Menu::show() {
             needsRedraw = false;
         }
 
-        int ch = keyboard->getKey(pdMS_TO_TICKS(100));
-        if (ch < 0)
+        // Sleep until a key, data changed event or the next tick (only when visible)
+        TickType_t timeout = portMAX_DELAY;
+        if (ovlVisible && tickInterval > 0) {
+            TickType_t elapsed  = xTaskGetTickCount() - prevTicks;
+            TickType_t interval = pdMS_TO_TICKS(tickInterval);
+            timeout             = (elapsed >= interval) ? 0 : interval - elapsed;
+        }
+
+        int ch = keyboard->getKey(timeout);
+        if (ch < 0) {
+            if (ovlVisible)
+                needsRedraw |= onTick();
+            prevTicks = xTaskGetTickCount();
+            continue;
+        }
+        if (ch == MENU_EVENT_CHANGED) {
+            needsRedraw |= onChanged();
+            continue;
+        }
+        if (ch > 0xFF)
             continue;
 
         if (ch == 0xFF) {
@@ -176,24 +187,24 @@ void Menu::show() {
 
         needsRedraw = true;
 
-        if (!items.empty()) {
+        if (getItemCount() > 0) {
             switch (ch) {
                 case CH_UP: {
                     do {
                         selectedRow--;
-                    } while (selectedRow > 0 && items[selectedRow].type == MenuItemType::separator);
+                    } while (selectedRow > 0 && getItem(selectedRow).type == MenuItemType::separator);
                     break;
                 }
 
                 case CH_DOWN: {
                     do {
                         selectedRow++;
-                    } while (selectedRow < (int)items.size() - 1 && items[selectedRow].type == MenuItemType::separator);
+                    } while (selectedRow < getItemCount() - 1 && getItem(selectedRow).type == MenuItemType::separator);
                     break;
                 }
 
                 case CH_LEFT: {
-                    auto &mi = items[selectedRow];
+                    auto &mi = getItem(selectedRow);
                     switch (mi.type) {
                         case MenuItemType::percentage: {
                             if (mi.setter && mi.getter)
@@ -211,7 +222,7 @@ void Menu::show() {
                 }
 
                 case CH_RIGHT: {
-                    auto &mi = items[selectedRow];
+                    auto &mi = getItem(selectedRow);
                     switch (mi.type) {
                         case MenuItemType::percentage: {
                             if (mi.setter && mi.getter)
@@ -234,12 +245,12 @@ void Menu::show() {
                 }
 
                 case CH_PGDN: {
-                    selectedRow = std::min((int)items.size() - 1, selectedRow + getVisibleRows());
+                    selectedRow = std::min(getItemCount() - 1, selectedRow + getVisibleRows());
                     break;
                 }
 
                 case CH_ENTER: {
-                    auto &mi = items[selectedRow];
+                    auto &mi = getItem(selectedRow);
                     // printf("Enter on row:%d '%s' has_onEnter:%d\n", selectedRow, mi.name.c_str(), (bool)mi.onEnter);
 
                     if (mi.onEnter) {
@@ -250,6 +261,11 @@ void Menu::show() {
                     }
                     break;
                 }
+
+                default: {
+                    onKey(ch);
+                    break;
+                }
             }
         }
     }
@@ -258,6 +274,10 @@ void Menu::show() {
     onExit();
 }
 
+void Menu::notifyChanged() {
+    Keyboard::instance()->postEvent(MENU_EVENT_CHANGED);
+}
+
 void Menu::drawMessage(const char *msg) {
     auto ovl = getDisplayOverlay();
     ovl->clearScreen();
@@ -12,6 +12,11 @@ enum class MenuItemType {
 
 class Menu;
 
+enum {
+    // Posted through Keyboard::postEvent to wake up the active menu
+    MENU_EVENT_CHANGED = 0x100,
+};
+
 struct MenuItem {
     MenuItem(MenuItemType _type, const std::string &_name = "")
         : type(_type), name(_name) {
@@ -34,15 +39,26 @@ public:
     std::string           title;
     int                   width;
     std::vector<MenuItem> items;
-    bool                  isRootMenu = false;
+    bool                  isRootMenu   = false;
+    unsigned              tickInterval = 0; // onTick interval in ms, 0 for none
 
     virtual void onEnter() {}
     virtual void onExit() {}
     virtual bool onTick() { return false; }
+    virtual bool onChanged() {
+        setNeedsUpdate();
+        return false;
+    }
     virtual void onUpdate() {}
+    virtual void onKey(int ch) {} // Keys not handled by the menu itself
 
     virtual void show();
 
+    // Item access used for drawing and navigation, can be overridden to
+    // materialize items on demand instead of storing them in 'items'
+    virtual int       getItemCount() { return (int)items.size(); }
+    virtual MenuItem &getItem(int idx) { return items[idx]; }
+
     static const unsigned colBg      = 11;
     static const unsigned colFg      = 8;
     static const unsigned colTitleFg = 7;
@@ -58,11 +74,14 @@ public:
     void resetSelectedRow() { selectedRow = 0; }
     void setExitMenu() { exitMenu = true; }
 
+    // Signal the active menu that its data changed, calls onChanged() from the menu task
+    static void notifyChanged();
+
     static void drawMessage(const char *msg);
     bool        editString(const std::string &title, std::string &value, int maxLen, bool isPassword = false);
 
     int getHeight() {
-        return std::min(23, 1 + (title.empty() ? 0 : 2) + (int)items.size() + 1);
+        return std::min(23, 1 + (title.empty() ? 0 : 2) + getItemCount() + 1);
     }
     int getVisibleRows() {
         return getHeight() - 2 - (title.empty() ? 0 : 2);
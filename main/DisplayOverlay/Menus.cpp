@@ -18,27 +18,31 @@ static EspSettingsMenu espSettingsMenu;
 class MainMenu : public Menu {
 public:
     MainMenu() : Menu("", 38) {
-        isRootMenu = true;
+        isRootMenu   = true;
+        tickInterval = 1000;
     }
 
-    void onUpdate() override {
-        setNeedsRedraw();
+    bool updateTitle() {
+        time_t now;
+        time(&now);
+        struct tm timeinfo = *localtime(&now);
 
-        // Update title
-        {
-            time_t now;
-            time(&now);
-            struct tm timeinfo = *localtime(&now);
+        char strftime_buf[20];
+        strftime(strftime_buf, sizeof(strftime_buf), "%Y-%m-%d %H:%M:%S", &timeinfo);
 
-            char strftime_buf[20];
-            strftime(strftime_buf, sizeof(strftime_buf), "%Y-%m-%d %H:%M:%S", &timeinfo);
+        char tmp[40];
 
-            char tmp[40];
+        const CoreInfo *coreInfo = FpgaCore::getCoreInfo();
+        snprintf(tmp, sizeof(tmp), "%-16s %s", coreInfo->name, strftime_buf);
+        if (title == tmp)
+            return false;
+        title = tmp;
+        return true;
+    }
 
-            const CoreInfo *coreInfo = FpgaCore::getCoreInfo();
-            snprintf(tmp, sizeof(tmp), "%-16s %s", coreInfo->name, strftime_buf);
-            title = tmp;
-        }
+    void onUpdate() override {
+        setNeedsRedraw();
+        updateTitle();
 
         items.clear();
 
@@ -77,8 +81,8 @@ public:
     }
 
     bool onTick() override {
-        setNeedsUpdate();
-        return false;
+        // Only the clock in the title changes, items are left as is
+        return updateTitle();
     }
 };
 
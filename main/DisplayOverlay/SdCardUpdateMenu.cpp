@@ -19,7 +19,7 @@ void SdCardUpdateMenu::doUpdate() {
 
     esp_ota_handle_t ota_handle  = 0;
     int              fd          = -1;
-    const size_t     tmpbuf_size = 65536;
+    const size_t     tmpbuf_size = 4096;
     void            *tmpbuf      = malloc(tmpbuf_size);
     bool             success     = false;
     auto             vfs         = getSDCardVFS();
@@ -39,6 +39,7 @@ void SdCardUpdateMenu::doUpdate() {
     if (fd < 0) {
         drawMessage(CONFIG_UPDATE_FILE_NAME " not found");
         vTaskDelay(pdMS_TO_TICKS(2000));
+        goto done;
     }
 
     update_size = st.st_size;
@@ -71,7 +72,7 @@ void SdCardUpdateMenu::doUpdate() {
     if ((update_partition = esp_ota_get_next_update_partition(nullptr)) == nullptr) {
         drawMessage("Can't find update partition");
         vTaskDelay(pdMS_TO_TICKS(2000));
-        return;
+        goto done;
     }
 
     drawMessage("Updating...");
@@ -81,11 +82,15 @@ void SdCardUpdateMenu::doUpdate() {
         goto done;
     }
 
-    vfs->seek(fd, 0);
+    // Stream update file into the OTA partition in small chunks
+    if (vfs->seek(fd, 0) < 0)
+        goto done;
 
     while (1) {
         int size = vfs->read(fd, tmpbuf_size, tmpbuf);
-        if (size <= 0)
+        if (size < 0)
+            goto done;
+        if (size == 0)
             break;
 
         if ((err = esp_ota_write(ota_handle, tmpbuf, size)) != ESP_OK) {
@@ -118,6 +123,7 @@ void SdCardUpdateMenu::doUpdate() {
 done:
     if (fd >= 0)
         vfs->close(fd);
+    free(tmpbuf);
 
     if (!success) {
         drawMessage("Upgrade failed.");
@@ -56,6 +56,7 @@ class WiFiMenu : public Menu {
 
 public:
     WiFiMenu() : Menu("Wi-Fi", 38) {
+        tickInterval = 1000;
     }
 
     MenuItem &addNetworkItem(const WiFiApInfo &info) {
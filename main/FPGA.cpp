@@ -1,10 +1,14 @@
 #include "FPGA.h"
 #include "Keyboard.h"
+#include "LatencyTrace.h"
 #ifdef EMULATOR
 #include "EmuState.h"
 #else
 
 #include <driver/spi_master.h>
+#include <esp_heap_caps.h>
+#include <hal/gpio_ll.h>
+#include <algorithm>
 
 static const char *TAG = "FPGA";
 
@@ -16,6 +20,17 @@ static const char *TAG = "FPGA";
 
 #define MAX_TRANSFER_SIZE (1024)
 
+// Double buffered streaming of bitstream data
+#define CFG_BUF_SIZE  (4096)
+#define CFG_BUF_TRANS (CFG_BUF_SIZE / MAX_TRANSFER_SIZE)
+
+// Queued command transactions
+#define CMD_QUEUE_SIZE (8)
+#define CMD_BUF_SIZE   (128)
+
+// Queued transactions drive SSEL, direct spiTx/spiRx transfers leave it to spiSel
+#define TRANS_SSEL ((void *)1)
+
 #endif
 
 enum {
@@ -28,6 +43,20 @@ public:
 #ifndef EMULATOR
     spi_device_handle_t cfgSpiDev;
     spi_device_handle_t cmdSpiDev;
+
+    uint8_t          *cfgBuf[2] = {nullptr, nullptr};
+    spi_transaction_t cfgTrans[2][CFG_BUF_TRANS];
+    unsigned          cfgBufPending[2] = {0, 0};
+    unsigned          cfgBufIdx        = 0;
+    unsigned          cfgBufLevel      = 0;
+
+    spi_transaction_t cmdTrans[CMD_QUEUE_SIZE];
+    void             *cmdReply[CMD_QUEUE_SIZE];    // Reply destination of spiCmd, valid until it returns
+    FpgaReply        *cmdFuture[CMD_QUEUE_SIZE];   // Reply future of spiCmdAsync
+    uint8_t           cmdReplyLen[CMD_QUEUE_SIZE]; // Reply bytes at the end of the transaction
+    uint8_t          *cmdBuf     = nullptr;
+    unsigned          cmdIdx     = 0;
+    unsigned          cmdPending = 0;
 #endif
 
     FPGAInt() {
@@ -55,7 +84,7 @@ public:
                 .mode           = 0,
                 .clock_speed_hz = 20000000,
                 .spics_io_num   = -1,
-                .queue_size     = 7,
+                .queue_size     = 2 * CFG_BUF_TRANS,
             };
             ESP_ERROR_CHECK(spi_bus_add_device(SPIBUS, &cfg, &cfgSpiDev));
         }
@@ -66,9 +95,14 @@ public:
                 .mode           = 0,
                 .clock_speed_hz = CONFIG_FPGA_SPI_SPEED_HZ,
                 .spics_io_num   = -1,
-                .queue_size     = 7,
+                .queue_size     = CMD_QUEUE_SIZE,
+                .pre_cb         = cmdPreTransCb,
+                .post_cb        = cmdPostTransCb,
             };
             ESP_ERROR_CHECK(spi_bus_add_device(SPIBUS, &cfg, &cmdSpiDev));
+
+            cmdBuf = (uint8_t *)heap_caps_malloc(CMD_QUEUE_SIZE * CMD_BUF_SIZE, MALLOC_CAP_DMA);
+            assert(cmdBuf != nullptr);
         }
 
         // Configure FPGA PROG# line
@@ -122,14 +156,41 @@ public:
 
     bool loadBitstream(const void *data, size_t length) override {
         RecursiveMutexLock lock(mutex);
-        ESP_LOGI(TAG, "Starting configuration");
 
 #ifdef EMULATOR
+        ESP_LOGI(TAG, "Starting configuration");
         EmuState::loadCore((const char *)data);
         if (EmuState::get())
             return true;
         return false;
 #else
+        if (!startBitstream())
+            return false;
+        if (!writeBitstream(data, length))
+            return false;
+        return finishBitstream();
+#endif
+    }
+
+    bool startBitstream() override {
+        RecursiveMutexLock lock(mutex);
+        ESP_LOGI(TAG, "Starting configuration");
+
+#ifdef EMULATOR
+        return false;
+#else
+        // Clean up any previously aborted configuration
+        cmdWaitAll();
+        cfgStreamEnd();
+        for (int i = 0; i < 2; i++) {
+            cfgBuf[i] = (uint8_t *)heap_caps_malloc(CFG_BUF_SIZE, MALLOC_CAP_DMA);
+            if (cfgBuf[i] == nullptr) {
+                ESP_LOGE(TAG, "Error allocating configuration buffers");
+                cfgStreamEnd();
+                return false;
+            }
+        }
+
 #ifdef CONFIG_MACHINE_TYPE_AQPLUS
         // Set FPGA INIT# as input
         gpio_set_direction(IOPIN_FPGA_INIT_B, GPIO_MODE_INPUT);
@@ -154,9 +215,47 @@ public:
         }
 #endif
 
-        // Send bitstream
         ESP_LOGI(TAG, "Sending bitstream");
-        cfgTx(data, length);
+        return true;
+#endif
+    }
+
+    bool writeBitstream(const void *data, size_t length) override {
+        RecursiveMutexLock lock(mutex);
+
+#ifdef EMULATOR
+        return false;
+#else
+        if (cfgBuf[0] == nullptr)
+            return false;
+
+        const uint8_t *p = (const uint8_t *)data;
+        while (length > 0) {
+            size_t size = std::min(length, (size_t)(CFG_BUF_SIZE - cfgBufLevel));
+            memcpy(cfgBuf[cfgBufIdx] + cfgBufLevel, p, size);
+            cfgBufLevel += size;
+            p += size;
+            length -= size;
+
+            if (cfgBufLevel == CFG_BUF_SIZE)
+                cfgBufFlush();
+        }
+        return true;
+#endif
+    }
+
+    bool finishBitstream() override {
+        RecursiveMutexLock lock(mutex);
+
+#ifdef EMULATOR
+        return false;
+#else
+        if (cfgBuf[0] == nullptr)
+            return false;
+
+        // Send remaining data and wait for all transfers to complete
+        cfgBufFlush();
+        cfgStreamEnd();
 
         // Keep sending clock pulses until DONE becomes high
         ESP_LOGI(TAG, "Sending extra clock cycles");
@@ -184,6 +283,50 @@ public:
     }
 
 #ifndef EMULATOR
+    // Queue the current buffer for transmission and switch to the other one,
+    // so the next chunk can be filled while this one is being sent.
+    void cfgBufFlush() {
+        unsigned idx    = cfgBufIdx;
+        unsigned offset = 0;
+        while (offset < cfgBufLevel) {
+            unsigned txsize = std::min(cfgBufLevel - offset, (unsigned)MAX_TRANSFER_SIZE);
+
+            spi_transaction_t *t = &cfgTrans[idx][cfgBufPending[idx]];
+            memset(t, 0, sizeof(*t));
+            t->length    = txsize * 8;
+            t->tx_buffer = cfgBuf[idx] + offset;
+            ESP_ERROR_CHECK(spi_device_queue_trans(cfgSpiDev, t, portMAX_DELAY));
+            cfgBufPending[idx]++;
+
+            offset += txsize;
+        }
+
+        cfgBufIdx   = idx ^ 1;
+        cfgBufLevel = 0;
+        cfgBufWait(cfgBufIdx);
+    }
+
+    // Transactions complete in order, so the other buffer's transactions are always
+    // collected before those of the buffer just queued.
+    void cfgBufWait(unsigned idx) {
+        while (cfgBufPending[idx] > 0) {
+            spi_transaction_t *t;
+            ESP_ERROR_CHECK(spi_device_get_trans_result(cfgSpiDev, &t, portMAX_DELAY));
+            cfgBufPending[idx]--;
+        }
+    }
+
+    void cfgStreamEnd() {
+        cfgBufWait(cfgBufIdx ^ 1);
+        cfgBufWait(cfgBufIdx);
+        for (int i = 0; i < 2; i++) {
+            free(cfgBuf[i]);
+            cfgBuf[i] = nullptr;
+        }
+        cfgBufIdx   = 0;
+        cfgBufLevel = 0;
+    }
+
     void cfgTx(const void *data, size_t length) {
         unsigned       remaining = length;
         const uint8_t *p         = (const uint8_t *)data;
@@ -205,6 +348,8 @@ public:
 
     void spiSel(bool enable) override {
 #ifndef EMULATOR
+        // Queued commands drive SSEL themselves, so let them finish first
+        cmdWaitAll();
         gpio_set_level(IOPIN_SPI_SSEL_N, !enable);
 #else
         auto emuState = EmuState::get();
@@ -216,6 +361,8 @@ public:
 
     void spiTx(const void *data, size_t length) override {
 #ifndef EMULATOR
+        cmdWaitAll();
+
         unsigned       remaining = length;
         const uint8_t *p         = (const uint8_t *)data;
         while (remaining > 0) {
@@ -241,6 +388,8 @@ public:
 
     void spiRx(void *buf, size_t length) override {
 #ifndef EMULATOR
+        cmdWaitAll();
+
         spi_transaction_t t = {0};
         t.length            = length * 8;
         t.rxlength          = length * 8;
@@ -256,28 +405,143 @@ public:
 #endif
     }
 
-#ifdef CONFIG_MACHINE_TYPE_MORPHBOOK
-    uint64_t getKeys() override {
-        uint64_t result;
+    void spiCmdAsync(const void *cmd, size_t cmdLen, FpgaReply *reply = nullptr, size_t replyLen = 0) override {
+        RecursiveMutexLock lock(mutex);
+        assert(replyLen == 0 || (reply != nullptr && replyLen <= sizeof(reply->data)));
+
+        if (replyLen == 0) {
+            cmdSubmit(cmd, cmdLen, nullptr, nullptr, 0);
+            return;
+        }
+
+        // A future can only track one command
+        reply->wait();
+        reply->pending = true;
+        cmdSubmit(cmd, cmdLen, nullptr, reply, replyLen);
+    }
 
+    void spiCmdWait() override {
         RecursiveMutexLock lock(mutex);
-        spiSel(true);
+#ifndef EMULATOR
+        cmdWaitAll();
+#endif
+    }
 
-        uint8_t cmd[] = {CMD_GET_KEYS, 0};
-        spiTx(cmd, sizeof(cmd));
-        spiRx(&result, sizeof(result));
+    void spiCmd(const void *cmd, size_t cmdLen, void *reply, size_t replyLen) override {
+        RecursiveMutexLock lock(mutex);
+
+        // The reply pointer is only stored while the mutex is held and is collected before returning
+        cmdSubmit(cmd, cmdLen, reply, nullptr, replyLen);
+        spiCmdWait();
+    }
 
+    void cmdSubmit(const void *cmd, size_t cmdLen, void *reply, FpgaReply *future, size_t replyLen) {
+        LatencyTrace::instance()->mark(TracePoint::Fpga);
+
+#ifndef EMULATOR
+        // Command and reply in a single full-duplex transaction, so every queue slot holds a
+        // complete command. The reply is received into the upper half of the slot buffer and
+        // copied to its destination when the transaction is collected.
+        if (replyLen == 0 ? cmdLen <= CMD_BUF_SIZE : cmdLen + replyLen <= CMD_BUF_SIZE / 2) {
+            uint8_t *buf;
+            auto     t     = cmdTransAlloc(&buf);
+            size_t   total = cmdLen + replyLen;
+            memcpy(buf, cmd, cmdLen);
+            memset(buf + cmdLen, 0, replyLen);
+            t->length    = total * 8;
+            t->tx_buffer = buf;
+            t->user      = TRANS_SSEL;
+            if (replyLen > 0) {
+                unsigned idx     = t - cmdTrans;
+                t->rxlength      = total * 8;
+                t->rx_buffer     = buf + CMD_BUF_SIZE / 2;
+                cmdReply[idx]    = reply;
+                cmdFuture[idx]   = future;
+                cmdReplyLen[idx] = replyLen;
+            }
+            cmdQueue(t);
+            return;
+        }
+#endif
+        spiSel(true);
+        spiTx(cmd, cmdLen);
+        if (replyLen > 0)
+            spiRx(future ? future->data : reply, replyLen);
         spiSel(false);
+        if (future)
+            future->pending = false;
+    }
+
+#ifndef EMULATOR
+    static void IRAM_ATTR cmdPreTransCb(spi_transaction_t *t) {
+        if (t->user == TRANS_SSEL)
+            gpio_ll_set_level(&GPIO, IOPIN_SPI_SSEL_N, 0);
+    }
+
+    static void IRAM_ATTR cmdPostTransCb(spi_transaction_t *t) {
+        if (t->user == TRANS_SSEL)
+            gpio_ll_set_level(&GPIO, IOPIN_SPI_SSEL_N, 1);
+    }
+
+    // Get the next transaction slot, waiting for the oldest queued transaction if all are in use
+    spi_transaction_t *cmdTransAlloc(uint8_t **buf) {
+        if (cmdPending == CMD_QUEUE_SIZE)
+            cmdWait(1);
+
+        unsigned idx = cmdIdx;
+        cmdIdx       = (cmdIdx + 1) % CMD_QUEUE_SIZE;
+
+        spi_transaction_t *t = &cmdTrans[idx];
+        memset(t, 0, sizeof(*t));
+        cmdReply[idx]    = nullptr;
+        cmdFuture[idx]   = nullptr;
+        cmdReplyLen[idx] = 0;
+        *buf             = cmdBuf + idx * CMD_BUF_SIZE;
+        return t;
+    }
 
+    void cmdQueue(spi_transaction_t *t) {
+        ESP_ERROR_CHECK(spi_device_queue_trans(cmdSpiDev, t, portMAX_DELAY));
+        cmdPending++;
+    }
+
+    void cmdWait(unsigned count) {
+        while (count > 0 && cmdPending > 0) {
+            spi_transaction_t *t;
+            ESP_ERROR_CHECK(spi_device_get_trans_result(cmdSpiDev, &t, portMAX_DELAY));
+            cmdPending--;
+            count--;
+
+            unsigned idx = t - cmdTrans;
+            if (cmdReplyLen[idx] == 0)
+                continue;
+
+            const uint8_t *reply = (const uint8_t *)t->rx_buffer + t->rxlength / 8 - cmdReplyLen[idx];
+            if (cmdReply[idx])
+                memcpy(cmdReply[idx], reply, cmdReplyLen[idx]);
+            if (cmdFuture[idx]) {
+                memcpy(cmdFuture[idx]->data, reply, cmdReplyLen[idx]);
+                cmdFuture[idx]->pending = false;
+            }
+        }
+    }
+
+    void cmdWaitAll() {
+        cmdWait(cmdPending);
+    }
+#endif
+
+#ifdef CONFIG_MACHINE_TYPE_MORPHBOOK
+    uint64_t getKeys() override {
+        uint8_t  cmd[] = {CMD_GET_KEYS, 0};
+        uint64_t result;
+        spiCmd(cmd, sizeof(cmd), &result, sizeof(result));
         return result;
     }
 
     void setVolume(uint16_t volume, bool spkEn) override {
-        RecursiveMutexLock lock(mutex);
-        spiSel(true);
         uint8_t cmd[] = {CMD_SET_VOLUME, (uint8_t)(volume & 0xFF), (uint8_t)(volume >> 8), (uint8_t)(spkEn ? 1 : 0)};
-        spiTx(cmd, sizeof(cmd));
-        spiSel(false);
+        spiCmdAsync(cmd, sizeof(cmd));
     }
 #endif
 
@@ -291,10 +555,7 @@ public:
             {
                 uint8_t rxData[8];
                 uint8_t cmd[] = {CMD_GET_SYSINFO, 0};
-                spiSel(true);
-                spiTx(cmd, sizeof(cmd));
-                spiRx(rxData, 8);
-                spiSel(false);
+                spiCmd(cmd, sizeof(cmd), rxData, 8);
 
                 info->coreType     = rxData[0];
                 info->flags        = rxData[1];
@@ -312,21 +573,13 @@ public:
             // Name1
             {
                 uint8_t cmd[] = {CMD_GET_NAME1, 0};
-
-                spiSel(true);
-                spiTx(cmd, sizeof(cmd));
-                spiRx(info->name, 8);
-                spiSel(false);
+                spiCmd(cmd, sizeof(cmd), info->name, 8);
             }
 
             // Name2
             {
                 uint8_t cmd[] = {CMD_GET_NAME2, 0};
-
-                spiSel(true);
-                spiTx(cmd, sizeof(cmd));
-                spiRx(info->name + 8, 8);
-                spiSel(false);
+                spiCmd(cmd, sizeof(cmd), info->name + 8, 8);
             }
             info->name[16] = 0;
 
@@ -339,12 +592,12 @@ public:
         return ok;
     }
 
-    void setOverlayText(const uint16_t buf[1024]) override {
+    void setOverlayText(const uint16_t buf[1024], size_t count = 1024) override {
         RecursiveMutexLock lock(mutex);
         spiSel(true);
         uint8_t cmd[] = {CMD_OVL_TEXT};
         spiTx(cmd, sizeof(cmd));
-        spiTx(buf, 2 * 1024);
+        spiTx(buf, 2 * std::min(count, (size_t)1024));
         spiSel(false);
     }
 
@@ -368,17 +621,9 @@ public:
 
 #ifndef EMULATOR
     uint8_t getStatus() {
-        RecursiveMutexLock lock(mutex);
-        spiSel(true);
-
         uint8_t cmd[] = {CMD_GET_STATUS, 0};
-        spiTx(cmd, sizeof(cmd));
-
         uint8_t result;
-        spiRx(&result, 1);
-
-        spiSel(false);
-
+        spiCmd(cmd, sizeof(cmd), &result, 1);
         return result;
     }
 
@@ -409,3 +654,8 @@ FPGA *FPGA::instance() {
     static FPGAInt obj;
     return &obj;
 }
+
+void FpgaReply::wait() {
+    if (pending)
+        FPGA::instance()->spiCmdWait();
+}
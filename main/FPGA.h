@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Common.h"
+#include <atomic>
 
 enum {
     // Aq+ command
@@ -41,6 +42,21 @@ struct CoreInfo {
     char    name[17];
 };
 
+// Future for the reply of a queued command, the reply is in 'data' after wait().
+// Destroying a pending reply waits for its command, so a queued reply can't
+// outlive its destination.
+struct FpgaReply {
+    uint8_t           data[4];
+    std::atomic<bool> pending{false};
+
+    FpgaReply() {}
+    FpgaReply(const FpgaReply &)            = delete;
+    FpgaReply &operator=(const FpgaReply &) = delete;
+    ~FpgaReply() { wait(); }
+
+    void wait();
+};
+
 class FPGA {
 public:
     static FPGA *instance();
@@ -51,20 +67,33 @@ public:
     virtual bool loadBitstream(const void *data, size_t length) = 0;
     virtual bool getCoreInfo(CoreInfo *info)                    = 0;
 
+    // Streaming FPGA configuration (hold the mutex from start until finish)
+    virtual bool startBitstream()                                = 0;
+    virtual bool writeBitstream(const void *data, size_t length) = 0;
+    virtual bool finishBitstream()                               = 0;
+
 #ifdef CONFIG_MACHINE_TYPE_MORPHBOOK
     // FPGA core interface
     virtual uint64_t getKeys()                              = 0;
     virtual void     setVolume(uint16_t volume, bool spkEn) = 0;
 #endif
 
-    // Display overlay
-    virtual void setOverlayText(const uint16_t buf[1024])  = 0;
-    virtual void setOverlayFont(const uint8_t buf[2048])   = 0;
-    virtual void setOverlayPalette(const uint16_t buf[16]) = 0;
+    // Display overlay (setOverlayText only uploads the first 'count' characters)
+    virtual void setOverlayText(const uint16_t buf[1024], size_t count = 1024) = 0;
+    virtual void setOverlayFont(const uint8_t buf[2048])                       = 0;
+    virtual void setOverlayPalette(const uint16_t buf[16])                     = 0;
 
     // To be used by core specific handlers
     virtual SemaphoreHandle_t getMutex()                             = 0;
     virtual void              spiSel(bool enable)                    = 0;
     virtual void              spiTx(const void *data, size_t length) = 0;
     virtual void              spiRx(void *buf, size_t length)        = 0;
+
+    // Queued command interface, each command is framed by SSEL automatically.
+    // spiCmdAsync returns as soon as the command is queued, an optional reply
+    // (up to 4 bytes) completes the given future. spiCmdWait waits for all queued
+    // commands. spiCmd waits for the reply.
+    virtual void spiCmdAsync(const void *cmd, size_t cmdLen, FpgaReply *reply = nullptr, size_t replyLen = 0) = 0;
+    virtual void spiCmdWait()                                                                                 = 0;
+    virtual void spiCmd(const void *cmd, size_t cmdLen, void *reply, size_t replyLen)                         = 0;
 };
@@ -6,6 +6,8 @@
 #include "Keyboard.h"
 #include "FPGA.h"
 #include "VFS.h"
+#include "FpgaCore.h"
+#include "LatencyTrace.h"
 #include <source_location>
 #include <esp_http_server.h>
 
@@ -82,7 +84,7 @@ public:
             return;
 
         httpd_config_t config   = HTTPD_DEFAULT_CONFIG();
-        config.max_uri_handlers = 11;
+        config.max_uri_handlers = 13;
         config.uri_match_fn     = httpd_uri_match_wildcard;
 
         ESP_LOGI(TAG, "Starting HTTP Server on port: '%d'", config.server_port);
@@ -92,6 +94,9 @@ public:
         }
 
         registerHandler("/keyboard", HTTP_POST, [&](httpd_req_t *req) { return postKeyboard(req); });
+        registerHandler("/savestate", HTTP_POST, [&](httpd_req_t *req) { return postSaveState(req); });
+        registerHandler("/run", HTTP_POST, [&](httpd_req_t *req) { return postRun(req); });
+        registerHandler("/latency", HTTP_GET, [&](httpd_req_t *req) { return getLatency(req); });
         registerHandler("/*", HTTP_DELETE, [&](httpd_req_t *req) { return handleDelete(req); });
         registerHandler("/*", HTTP_GET, [&](httpd_req_t *req) { return handleGet(req); });
         registerHandler("/*", HTTP_HEAD, [&](httpd_req_t *req) { return handleHead(req); });
@@ -546,6 +551,43 @@ public:
         return resp204(req);
     }
 
+    static bool getPathFromQuery(httpd_req_t *req, std::string &result) {
+        char query[256];
+        char path[256];
+        if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+            httpd_query_key_value(query, "path", path, sizeof(path)) != ESP_OK)
+            return false;
+
+        result = urlDecode(path);
+        return true;
+    }
+
+    esp_err_t postSaveState(httpd_req_t *req) {
+        // Path of state file on SD card is passed as query parameter: /savestate?path=state.aqs
+        std::string path;
+        if (!getPathFromQuery(req, path))
+            return resp400(req);
+
+        auto core = FpgaCore::get();
+        if (!core)
+            return mapResult(req, ERR_OTHER);
+
+        return mapResult(req, core->saveState(path.c_str()));
+    }
+
+    esp_err_t postRun(httpd_req_t *req) {
+        // Load program from SD card directly into memory: /run?path=game.caq
+        std::string path;
+        if (!getPathFromQuery(req, path))
+            return resp400(req);
+
+        auto core = FpgaCore::get();
+        if (!core)
+            return mapResult(req, ERR_OTHER);
+
+        return mapResult(req, core->runProgram(path.c_str()));
+    }
+
     esp_err_t postKeyboard(httpd_req_t *req) {
         // Allocate buffers
         const size_t tmpSize = 16384;
@@ -575,6 +617,25 @@ public:
         }
         return resp204(req);
     }
+
+    esp_err_t getLatency(httpd_req_t *req) {
+        auto trace = LatencyTrace::instance();
+
+        std::string result = "{";
+        for (int i = 0; i < (int)TracePoint::Count; i++) {
+            auto stats = trace->getStats((TracePoint)i);
+
+            char tmp[128];
+            snprintf(
+                tmp, sizeof(tmp), "%s\"%s\":{\"count\":%u,\"p50\":%u,\"p99\":%u,\"max\":%u}",
+                i > 0 ? "," : "", trace->getName((TracePoint)i), stats.count, stats.p50, stats.p99, stats.max);
+            result += tmp;
+        }
+        result += "}\n";
+
+        httpd_resp_set_type(req, "application/json");
+        return httpd_resp_send(req, result.c_str(), result.size());
+    }
 };
 
 FileServer *getFileServer() {
@@ -66,53 +66,42 @@ public:
         // |   8 | Modifier: Ctrl               |
         // | 7:0 | Character / Scancode         |
 
-        auto               fpga = FPGA::instance();
-        RecursiveMutexLock lock(fpga->getMutex());
-        fpga->spiSel(true);
         uint8_t cmd[] = {CMD_WRITE_KBBUF16, (uint8_t)(data & 0xFF), (uint8_t)(data >> 8)};
-        fpga->spiTx(cmd, sizeof(cmd));
-        fpga->spiSel(false);
+        FPGA::instance()->spiCmdAsync(cmd, sizeof(cmd));
     }
 
     void aqpUpdateKeybMatrix(uint64_t keybMatrix) {
-        auto               fpga = FPGA::instance();
-        RecursiveMutexLock lock(fpga->getMutex());
-        fpga->spiSel(true);
         uint8_t cmd[9];
         cmd[0] = CMD_SET_KEYB_MATRIX;
         memcpy(&cmd[1], &keybMatrix, 8);
-        fpga->spiTx(cmd, sizeof(cmd));
-        fpga->spiSel(false);
+        FPGA::instance()->spiCmdAsync(cmd, sizeof(cmd));
     }
 
     void aqpUpdateKeybMatrix(unsigned idx, const GamePadData &data) {
-        auto               fpga = FPGA::instance();
-        RecursiveMutexLock lock(fpga->getMutex());
-        fpga->spiSel(true);
         uint8_t cmd[9];
         cmd[0] = (idx == 0) ? CMD_WRITE_GAMEPAD1 : CMD_WRITE_GAMEPAD2;
         memcpy(&cmd[1], &data, 8);
-        fpga->spiTx(cmd, sizeof(cmd));
-        fpga->spiSel(false);
+        FPGA::instance()->spiCmdAsync(cmd, sizeof(cmd));
     }
 
     void aqpUpdateHandCtrl(uint8_t hctrl1, uint8_t hctrl2) {
-        auto               fpga = FPGA::instance();
-        RecursiveMutexLock lock(fpga->getMutex());
-        fpga->spiSel(true);
         uint8_t cmd[] = {CMD_SET_HCTRL, hctrl1, hctrl2};
-        fpga->spiTx(cmd, sizeof(cmd));
-        fpga->spiSel(false);
+        FPGA::instance()->spiCmdAsync(cmd, sizeof(cmd));
     }
 
     void resetCore() override {
-        auto               fpga = FPGA::instance();
-        RecursiveMutexLock lock(fpga->getMutex());
-
-        fpga->spiSel(true);
         uint8_t cmd[] = {CMD_RESET, 0};
-        fpga->spiTx(cmd, sizeof(cmd));
-        fpga->spiSel(false);
+        FPGA::instance()->spiCmdAsync(cmd, sizeof(cmd));
+    }
+
+    void keyBatchBegin() override {
+        RecursiveMutexLock lock(mutex);
+        kbHcEmu.beginBatch();
+    }
+
+    void keyBatchEnd() override {
+        RecursiveMutexLock lock(mutex);
+        kbHcEmu.endBatch();
     }
 
     bool keyScancode(uint8_t modifiers, unsigned scanCode, bool keyDown) override {
@@ -1,6 +1,7 @@
 #include "FpgaCore.h"
 
 #include "Common.h"
+#include "DisplayOverlay/FileListMenu.h"
 #include "FPGA.h"
 #include "KbHcEmu.h"
 #include "Keyboard.h"
@@ -8,11 +9,25 @@
 #include "VFS.h"
 
 #include <nvs_flash.h>
+#include <algorithm>
+
+static const char *TAG = "CoreAquariusPlus";
 
 enum {
     IO_VCTRL    = 0xE0,
+    IO_VSCRX_L  = 0xE1,
+    IO_VSCRX_H  = 0xE2,
+    IO_VSCRY    = 0xE3,
+    IO_VSPRSEL  = 0xE4,
+    IO_VSPRX_L  = 0xE5,
+    IO_VSPRX_H  = 0xE6,
+    IO_VSPRY    = 0xE7,
+    IO_VSPRIDX  = 0xE8,
+    IO_VSPRATTR = 0xE9,
     IO_VPALSEL  = 0xEA,
     IO_VPALDATA = 0xEB,
+    IO_VIRQLINE = 0xED,
+    IO_IRQMASK  = 0xEE,
     IO_BANK0    = 0xF0,
     IO_BANK1    = 0xF1,
     IO_BANK2    = 0xF2,
@@ -28,9 +43,114 @@ enum {
     FLAG_ALT_BAUDRATE  = (1 << 5),
 };
 
+#ifdef CONFIG_MACHINE_TYPE_AQPLUS
+// Save state file: 'AQSS', version, followed by records terminated by STATE_REC_END.
+// Each record: id, raw length (16-bit LE), packed length (16-bit LE), run-length encoded data.
+#define STATE_VERSION (1)
+
+enum {
+    STATE_REC_REGS    = 0x80,
+    STATE_REC_PALETTE = 0x81,
+    STATE_REC_TEXT    = 0x82,
+    STATE_REC_SPRITES = 0x83,
+    STATE_REC_END     = 0xFF,
+};
+
+// Registers in the order they are stored, written back last on restore
+static const uint8_t stateRegs[] = {IO_VCTRL, IO_VSCRX_L, IO_VSCRX_H, IO_VSCRY, IO_VSPRSEL, IO_VPALSEL, IO_VIRQLINE, IO_IRQMASK, IO_BANK0, IO_BANK1, IO_BANK2, IO_BANK3};
+static const uint8_t spriteRegs[] = {IO_VSPRX_L, IO_VSPRX_H, IO_VSPRY, IO_VSPRIDX, IO_VSPRATTR};
+
+// Pages captured: video RAM, character RAM and 512KB main RAM
+static bool isStatePage(unsigned page) {
+    return page == 20 || page == 21 || (page >= 32 && page < 64);
+}
+
+static size_t statePageSize(unsigned page) {
+    return page == 21 ? 2048 : 16384;
+}
+
+// BASIC program text and pointers to the end of it (Aquarius S2 BASIC)
+#define BASIC_TXTTAB (0x3901)
+#define BASIC_VARTAB (0x38D6)
+
+// BASIC cursor column followed by the cursor address in screen RAM
+#define BASIC_TTYPOS   (0x3800)
+#define SCREEN_RAM     (0x3000)
+#define SCREEN_COLUMNS (40)
+#define SCREEN_ROWS    (25)
+
+// Skip a CAQ sync pattern (0xFF bytes followed by 0x00)
+static bool skipCaqSync(const std::vector<uint8_t> &buf, size_t &offset) {
+    size_t start = offset;
+    while (offset < buf.size() && buf[offset] == 0xFF)
+        offset++;
+    if (offset == start || offset >= buf.size() || buf[offset] != 0x00)
+        return false;
+    offset++;
+    return true;
+}
+
+// PackBits style run-length encoding, dst should hold at least length + (length + 127) / 128 bytes
+static size_t rleEncode(const uint8_t *src, size_t length, uint8_t *dst) {
+    size_t i = 0;
+    size_t o = 0;
+    while (i < length) {
+        size_t run = 1;
+        while (i + run < length && run < 128 && src[i + run] == src[i])
+            run++;
+
+        if (run >= 3) {
+            dst[o++] = (uint8_t)(257 - run);
+            dst[o++] = src[i];
+            i += run;
+            continue;
+        }
+
+        // Literals up to the next run of 3 or more
+        size_t start = i;
+        size_t count = 0;
+        while (i < length && count < 128) {
+            if (i + 2 < length && src[i] == src[i + 1] && src[i] == src[i + 2])
+                break;
+            i++;
+            count++;
+        }
+        dst[o++] = (uint8_t)(count - 1);
+        memcpy(dst + o, src + start, count);
+        o += count;
+    }
+    return o;
+}
+
+static bool rleDecode(const uint8_t *src, size_t srcLen, uint8_t *dst, size_t dstLen) {
+    size_t i = 0;
+    size_t o = 0;
+    while (i < srcLen) {
+        uint8_t n = src[i++];
+        if (n < 128) {
+            size_t count = n + 1;
+            if (count > srcLen - i || count > dstLen - o)
+                return false;
+            memcpy(dst + o, src + i, count);
+            i += count;
+            o += count;
+
+        } else if (n > 128) {
+            size_t count = 257 - n;
+            if (i >= srcLen || count > dstLen - o)
+                return false;
+            memset(dst + o, src[i++], count);
+            o += count;
+        }
+    }
+    return o == dstLen;
+}
+#endif
+
 class CoreAquariusPlus : public FpgaCore {
 public:
     SemaphoreHandle_t mutex;
+    SemaphoreHandle_t busMutex; // Held while the ESP has the Z80 bus
     KbHcEmu           kbHcEmu;
     uint8_t           videoTimingMode   = 0;
     bool              useT80            = false;
@@ -52,6 +172,7 @@ public:
 
     CoreAquariusPlus() {
         mutex            = xSemaphoreCreateRecursiveMutex();
+        busMutex         = xSemaphoreCreateRecursiveMutex();
         bypassStartTimer = xTimerCreate("", pdMS_TO_TICKS(CONFIG_BYPASS_START_TIME_MS), pdFALSE, this, _onBypassStartTimer);
 
         auto coreInfo            = getCoreInfo();
@@ -128,27 +249,21 @@ public:
     }
 
     void aqpWriteKeybBuffer(uint8_t ch) {
-        auto               fpga = FPGA::instance();
-        RecursiveMutexLock lock(fpga->getMutex());
-        fpga->spiSel(true);
         uint8_t cmd[] = {CMD_WRITE_KBBUF, ch};
-        fpga->spiTx(cmd, sizeof(cmd));
-        fpga->spiSel(false);
+        FPGA::instance()->spiCmdAsync(cmd, sizeof(cmd));
     }
 
     void resetCore() override {
         auto               fpga = FPGA::instance();
         RecursiveMutexLock lock(fpga->getMutex());
-        fpga->spiSel(true);
-        uint8_t resetCfg = 0;
+        uint8_t            resetCfg = 0;
         if (useT80)
             resetCfg |= 1;
         if (!warmReset)
             resetCfg |= 2;
 
         uint8_t cmd[] = {CMD_RESET, resetCfg};
-        fpga->spiTx(cmd, sizeof(cmd));
-        fpga->spiSel(false);
+        fpga->spiCmdAsync(cmd, sizeof(cmd));
 
         warmReset = true;
 
@@ -163,108 +278,119 @@ public:
     }
 
     void aqpForceTurbo(bool en) {
-        auto               fpga = FPGA::instance();
-        RecursiveMutexLock lock(fpga->getMutex());
-        fpga->spiSel(true);
         uint8_t cfg   = en ? 1 : 0;
         uint8_t cmd[] = {CMD_FORCE_TURBO, cfg};
-        fpga->spiTx(cmd, sizeof(cmd));
-        fpga->spiSel(false);
+        FPGA::instance()->spiCmdAsync(cmd, sizeof(cmd));
     }
 
     void aqpUpdateKeybMatrix(uint64_t keybMatrix) {
-        auto               fpga = FPGA::instance();
-        RecursiveMutexLock lock(fpga->getMutex());
-        fpga->spiSel(true);
         uint8_t cmd[9];
         cmd[0] = CMD_SET_KEYB_MATRIX;
         memcpy(&cmd[1], &keybMatrix, 8);
-        fpga->spiTx(cmd, sizeof(cmd));
-        fpga->spiSel(false);
+        FPGA::instance()->spiCmdAsync(cmd, sizeof(cmd));
     }
 
     void aqpUpdateHandCtrl(uint8_t hctrl1, uint8_t hctrl2) {
-        auto               fpga = FPGA::instance();
-        RecursiveMutexLock lock(fpga->getMutex());
-        fpga->spiSel(true);
         uint8_t cmd[] = {CMD_SET_HCTRL, hctrl1, hctrl2};
-        fpga->spiTx(cmd, sizeof(cmd));
-        fpga->spiSel(false);
+        FPGA::instance()->spiCmdAsync(cmd, sizeof(cmd));
     }
 
     void aqpSetVideoMode(uint8_t mode) {
-        auto               fpga = FPGA::instance();
-        RecursiveMutexLock lock(fpga->getMutex());
-        fpga->spiSel(true);
         uint8_t cmd[] = {CMD_SET_VIDMODE, mode};
-        fpga->spiTx(cmd, sizeof(cmd));
-        fpga->spiSel(false);
+        FPGA::instance()->spiCmdAsync(cmd, sizeof(cmd));
     }
 
 #ifdef CONFIG_MACHINE_TYPE_AQPLUS
     void aqpAqcuireBus() {
-        auto               fpga = FPGA::instance();
-        RecursiveMutexLock lock(fpga->getMutex());
-        fpga->spiSel(true);
         uint8_t cmd[] = {CMD_BUS_ACQUIRE};
-        fpga->spiTx(cmd, sizeof(cmd));
-        fpga->spiSel(false);
+        FPGA::instance()->spiCmdAsync(cmd, sizeof(cmd));
     }
 
     void aqpReleaseBus() {
-        auto               fpga = FPGA::instance();
-        RecursiveMutexLock lock(fpga->getMutex());
-        fpga->spiSel(true);
         uint8_t cmd[] = {CMD_BUS_RELEASE};
-        fpga->spiTx(cmd, sizeof(cmd));
-        fpga->spiSel(false);
+        FPGA::instance()->spiCmdAsync(cmd, sizeof(cmd));
     }
 
     void aqpWriteMem(uint16_t addr, uint8_t data) {
-        auto               fpga = FPGA::instance();
-        RecursiveMutexLock lock(fpga->getMutex());
-        fpga->spiSel(true);
         uint8_t cmd[] = {CMD_MEM_WRITE, (uint8_t)(addr & 0xFF), (uint8_t)(addr >> 8), data};
-        fpga->spiTx(cmd, sizeof(cmd));
-        fpga->spiSel(false);
+        FPGA::instance()->spiCmdAsync(cmd, sizeof(cmd));
     }
 
     uint8_t aqpReadMem(uint16_t addr) {
-        auto               fpga = FPGA::instance();
-        RecursiveMutexLock lock(fpga->getMutex());
-        fpga->spiSel(true);
         uint8_t cmd[] = {CMD_MEM_READ, (uint8_t)(addr & 0xFF), (uint8_t)(addr >> 8)};
-        fpga->spiTx(cmd, sizeof(cmd));
-
         uint8_t result[2];
-        fpga->spiRx(result, 2);
-        fpga->spiSel(false);
+        FPGA::instance()->spiCmd(cmd, sizeof(cmd), result, 2);
         return result[1];
     }
 
     void aqpWriteIO(uint16_t addr, uint8_t data) {
-        auto               fpga = FPGA::instance();
-        RecursiveMutexLock lock(fpga->getMutex());
-        fpga->spiSel(true);
         uint8_t cmd[] = {CMD_IO_WRITE, (uint8_t)(addr & 0xFF), (uint8_t)(addr >> 8), data};
-        fpga->spiTx(cmd, sizeof(cmd));
-        fpga->spiSel(false);
+        FPGA::instance()->spiCmdAsync(cmd, sizeof(cmd));
     }
 
     uint8_t aqpReadIO(uint16_t addr) {
-        auto               fpga = FPGA::instance();
-        RecursiveMutexLock lock(fpga->getMutex());
-        fpga->spiSel(true);
         uint8_t cmd[] = {CMD_IO_READ, (uint8_t)(addr & 0xFF), (uint8_t)(addr >> 8)};
-        fpga->spiTx(cmd, sizeof(cmd));
-
         uint8_t result[2];
-        fpga->spiRx(result, 2);
-        fpga->spiSel(false);
+        FPGA::instance()->spiCmd(cmd, sizeof(cmd), result, 2);
         return result[1];
     }
+
+    // Queue an IO read without waiting, the value is in result.data[1] once it completed
+    void aqpQueueReadIO(uint16_t addr, FpgaReply &result) {
+        uint8_t cmd[] = {CMD_IO_READ, (uint8_t)(addr & 0xFF), (uint8_t)(addr >> 8)};
+        FPGA::instance()->spiCmdAsync(cmd, sizeof(cmd), &result, 2);
+    }
+
+    // Block transfers hold the FPGA mutex per batch, callers hold busMutex
+    void aqpReadMemBlock(uint16_t addr, void *buf, size_t length) {
+        auto fpga = FPGA::instance();
+
+        // Queue the reads instead of waiting for each byte. The FPGA command queue keeps
+        // up to 8 reads in flight, the batch size only sets how often to collect results.
+        FpgaReply result[64];
+        uint8_t  *p = (uint8_t *)buf;
+        while (length > 0) {
+            RecursiveMutexLock lock(fpga->getMutex());
+            size_t             count = std::min(length, sizeof(result) / sizeof(result[0]));
+            for (size_t i = 0; i < count; i++) {
+                uint16_t a     = addr + i;
+                uint8_t  cmd[] = {CMD_MEM_READ, (uint8_t)(a & 0xFF), (uint8_t)(a >> 8)};
+                fpga->spiCmdAsync(cmd, sizeof(cmd), &result[i], 2);
+            }
+            fpga->spiCmdWait();
+
+            for (size_t i = 0; i < count; i++)
+                *(p++) = result[i].data[1];
+
+            addr += count;
+            length -= count;
+        }
+    }
+
+    void aqpWriteMemBlock(uint16_t addr, const void *buf, size_t length) {
+        auto fpga = FPGA::instance();
+
+        const uint8_t *p = (const uint8_t *)buf;
+        for (size_t offset = 0; offset < length; offset += 64) {
+            RecursiveMutexLock lock(fpga->getMutex());
+            size_t             count = std::min(length - offset, (size_t)64);
+            for (size_t i = 0; i < count; i++)
+                aqpWriteMem(addr + offset + i, p[offset + i]);
+            fpga->spiCmdWait();
+        }
+    }
 #endif
 
+    void keyBatchBegin() override {
+        RecursiveMutexLock lock(mutex);
+        kbHcEmu.beginBatch();
+    }
+
+    void keyBatchEnd() override {
+        RecursiveMutexLock lock(mutex);
+        kbHcEmu.endBatch();
+    }
+
     bool keyScancode(uint8_t modifiers, unsigned scanCode, bool keyDown) override {
         RecursiveMutexLock lock(mutex);
         if (kbHcEmu.keyScancode(modifiers, scanCode, keyDown))
@@ -396,46 +522,55 @@ public:
 #ifdef CONFIG_MACHINE_TYPE_AQPLUS
     void takeScreenshot(Menu &menu) {
         auto               fpga = FPGA::instance();
+        RecursiveMutexLock busLock(busMutex);
         RecursiveMutexLock lock(fpga->getMutex());
 
         menu.drawMessage("Taking screenshot");
 
         std::vector<uint8_t> buf;
+        int64_t              tStart = esp_timer_get_time();
 
         // Read text RAM
         {
             // Get state
             aqpAqcuireBus();
-            uint8_t vctrl   = aqpReadIO(IO_VCTRL);
-            uint8_t vpalsel = aqpReadIO(IO_VPALSEL);
-            uint8_t bank0   = aqpReadIO(IO_BANK0);
+            FpgaReply state[3];
+            aqpQueueReadIO(IO_VCTRL, state[0]);
+            aqpQueueReadIO(IO_VPALSEL, state[1]);
+            aqpQueueReadIO(IO_BANK0, state[2]);
+            fpga->spiCmdWait();
+            uint8_t vctrl   = state[0].data[1];
+            uint8_t vpalsel = state[1].data[1];
+            uint8_t bank0   = state[2].data[1];
 
             if (vctrl & 1) {
                 aqpWriteIO(IO_BANK0, (3 << 6) | 0);
 
                 bool mode80 = (vctrl & 0x40) != 0;
-                buf.reserve(mode80 ? (4096 + 32 + 1) : (2048 + 32 + 1));
+                buf.resize(mode80 ? 4096 : 2048);
 
                 // Read text and color RAM
                 {
                     if (mode80)
                         aqpWriteIO(IO_VCTRL, vctrl & ~0x80);
 
-                    for (int i = 0; i < 2048; i++)
-                        buf.push_back(aqpReadMem(0x3000 + i));
+                    aqpReadMemBlock(0x3000, buf.data(), 2048);
 
                     if (mode80) {
                         aqpWriteIO(IO_VCTRL, vctrl | 0x80);
-                        for (int i = 0; i < 2048; i++)
-                            buf.push_back(aqpReadMem(0x3000 + i));
+                        aqpReadMemBlock(0x3000, buf.data() + 2048, 2048);
                     }
                 }
 
                 // Read palette
+                FpgaReply palette[32];
                 for (int i = 0; i < 32; i++) {
                     aqpWriteIO(IO_VPALSEL, i);
-                    buf.push_back(aqpReadIO(IO_VPALDATA));
+                    aqpQueueReadIO(IO_VPALDATA, palette[i]);
                 }
+                fpga->spiCmdWait();
+                for (int i = 0; i < 32; i++)
+                    buf.push_back(palette[i].data[1]);
 
                 // Save video mode
                 buf.push_back(vctrl & 0x61);
@@ -446,7 +581,9 @@ public:
             aqpWriteIO(IO_VPALSEL, vpalsel);
             aqpWriteIO(IO_VCTRL, vctrl);
             aqpReleaseBus();
+            fpga->spiCmdWait();
         }
+        ESP_LOGI(TAG, "Screenshot read in %u ms", (unsigned)((esp_timer_get_time() - tStart) / 1000));
 
         if (!buf.empty()) {
             std::string fileName = "screenshot.scr";
@@ -464,12 +601,14 @@ public:
 
     void dumpCartridge(Menu &menu) {
         auto               fpga = FPGA::instance();
+        RecursiveMutexLock busLock(busMutex);
         RecursiveMutexLock lock(fpga->getMutex());
 
         menu.drawMessage("Reading cartridge");
 
         std::vector<uint8_t> buf;
-        buf.reserve(16384);
+        buf.resize(16384);
+        int64_t tStart = esp_timer_get_time();
 
         // Read cartridge
         {
@@ -478,13 +617,14 @@ public:
             uint8_t bank0 = aqpReadIO(IO_BANK0);
 
             aqpWriteIO(IO_BANK0, 19);
-            for (int i = 0; i < 16384; i++)
-                buf.push_back(aqpReadMem(i));
+            aqpReadMemBlock(0, buf.data(), 16384);
 
             // Restore state
             aqpWriteIO(IO_BANK0, bank0);
             aqpReleaseBus();
+            fpga->spiCmdWait();
         }
+        ESP_LOGI(TAG, "Cartridge read in %u ms", (unsigned)((esp_timer_get_time() - tStart) / 1000));
 
         // Check contents
         bool hasData = false;
@@ -518,6 +658,458 @@ public:
             }
         }
     }
+    int saveState(const char *path) override {
+        auto coreInfo = getCoreInfo();
+        if ((coreInfo->flags & FLAG_AQPLUS) == 0 || coreInfo->versionMajor >= 2)
+            return ERR_PARAM;
+
+        auto vfs = getSDCardVFS();
+        int  fd  = vfs->open(FO_WRONLY | FO_CREATE | FO_TRUNC, path);
+        if (fd < 0)
+            return fd;
+
+        // The FPGA mutex is only held per transfer batch, so input keeps flowing to the core
+        auto               fpga = FPGA::instance();
+        RecursiveMutexLock busLock(busMutex);
+        int64_t            tStart = esp_timer_get_time();
+
+        std::vector<uint8_t> raw(16384);
+        std::vector<uint8_t> packed(5 + raw.size() + (raw.size() + 127) / 128);
+        size_t               fileSize = 0;
+        int                  result   = 0;
+
+        auto write = [&](const void *buf, size_t length) {
+            if (result != 0)
+                return;
+            int written = vfs->write(fd, length, buf);
+            if (written < 0)
+                result = written;
+            else if ((size_t)written != length)
+                result = ERR_OTHER;
+            fileSize += length;
+        };
+        auto writeRecord = [&](uint8_t id, size_t length) {
+            size_t packedLen = rleEncode(raw.data(), length, packed.data() + 5);
+            packed[0]        = id;
+            packed[1]        = length & 0xFF;
+            packed[2]        = length >> 8;
+            packed[3]        = packedLen & 0xFF;
+            packed[4]        = packedLen >> 8;
+            write(packed.data(), 5 + packedLen);
+        };
+
+        const uint8_t header[] = {'A', 'Q', 'S', 'S', STATE_VERSION};
+        write(header, sizeof(header));
+
+        aqpAqcuireBus();
+
+        // Registers
+        uint8_t saved[sizeof(stateRegs)];
+        {
+            RecursiveMutexLock lock(fpga->getMutex());
+            FpgaReply          regs[sizeof(stateRegs)];
+            for (size_t i = 0; i < sizeof(stateRegs); i++)
+                aqpQueueReadIO(stateRegs[i], regs[i]);
+            fpga->spiCmdWait();
+            for (size_t i = 0; i < sizeof(stateRegs); i++)
+                saved[i] = regs[i].data[1];
+        }
+        memcpy(raw.data(), saved, sizeof(saved));
+        writeRecord(STATE_REC_REGS, sizeof(saved));
+        uint8_t vctrl = saved[0];
+
+        // Palette
+        {
+            RecursiveMutexLock lock(fpga->getMutex());
+            FpgaReply          palette[128];
+            for (int i = 0; i < 128; i++) {
+                aqpWriteIO(IO_VPALSEL, i);
+                aqpQueueReadIO(IO_VPALDATA, palette[i]);
+            }
+            fpga->spiCmdWait();
+            for (int i = 0; i < 128; i++)
+                raw[i] = palette[i].data[1];
+        }
+        writeRecord(STATE_REC_PALETTE, 128);
+
+        // Sprite attributes
+        {
+            uint8_t *p = raw.data();
+            for (int i = 0; i < 64; i++) {
+                RecursiveMutexLock lock(fpga->getMutex());
+                FpgaReply          attr[sizeof(spriteRegs)];
+                aqpWriteIO(IO_VSPRSEL, i);
+                for (size_t j = 0; j < sizeof(spriteRegs); j++)
+                    aqpQueueReadIO(spriteRegs[j], attr[j]);
+                fpga->spiCmdWait();
+                for (size_t j = 0; j < sizeof(spriteRegs); j++)
+                    *(p++) = attr[j].data[1];
+            }
+        }
+        writeRecord(STATE_REC_SPRITES, 64 * sizeof(spriteRegs));
+
+        // Text and color RAM (both text pages)
+        aqpWriteIO(IO_BANK0, (3 << 6) | 0);
+        aqpWriteIO(IO_VCTRL, vctrl & ~0x80);
+        aqpReadMemBlock(0x3000, raw.data(), 2048);
+        aqpWriteIO(IO_VCTRL, vctrl | 0x80);
+        aqpReadMemBlock(0x3000, raw.data() + 2048, 2048);
+        writeRecord(STATE_REC_TEXT, 4096);
+
+        // Memory pages
+        for (unsigned page = 0; page < 64 && result == 0; page++) {
+            if (!isStatePage(page))
+                continue;
+
+            size_t size = statePageSize(page);
+            aqpWriteIO(IO_BANK0, page);
+            aqpReadMemBlock(0, raw.data(), size);
+            writeRecord(page, size);
+        }
+        writeRecord(STATE_REC_END, 0);
+
+        // Restore state
+        {
+            RecursiveMutexLock lock(fpga->getMutex());
+            for (size_t i = 0; i < sizeof(stateRegs); i++)
+                aqpWriteIO(stateRegs[i], saved[i]);
+            aqpReleaseBus();
+            fpga->spiCmdWait();
+        }
+
+        vfs->close(fd);
+        if (result != 0) {
+            // Don't leave a truncated state file behind
+            vfs->delete_(path);
+            return result;
+        }
+        ESP_LOGI(TAG, "State saved in %u ms (%u bytes)", (unsigned)((esp_timer_get_time() - tStart) / 1000), (unsigned)fileSize);
+        return 0;
+    }
+
+    // Read and decode the next save state record into 'raw', returns false on a malformed record
+    static bool readStateRecord(VFS *vfs, int fd, std::vector<uint8_t> &packed, std::vector<uint8_t> &raw, unsigned &id, size_t &length) {
+        uint8_t rec[5];
+        if (vfs->read(fd, sizeof(rec), rec) != (int)sizeof(rec))
+            return false;
+
+        id               = rec[0];
+        length           = rec[1] | (rec[2] << 8);
+        size_t packedLen = rec[3] | (rec[4] << 8);
+        if (id == STATE_REC_END)
+            return length == 0;
+
+        packed.resize(packedLen);
+        return (
+            length <= raw.size() && packedLen > 0 &&
+            vfs->read(fd, packedLen, packed.data()) == (int)packedLen &&
+            rleDecode(packed.data(), packedLen, raw.data(), length));
+    }
+
+    static bool isValidStateRecord(unsigned id, size_t length) {
+        switch (id) {
+            case STATE_REC_REGS: return length == sizeof(stateRegs);
+            case STATE_REC_PALETTE: return length == 128;
+            case STATE_REC_SPRITES: return length == 64 * sizeof(spriteRegs);
+            case STATE_REC_TEXT: return length == 4096;
+            default: return isStatePage(id) && length == statePageSize(id);
+        }
+    }
+
+    // Restores memory and video state only. The Z80 registers can't be reached from the ESP,
+    // so the CPU resumes with whatever it was doing; this isn't offered to users until the
+    // gateware can save and restore the CPU state.
+    int loadState(const char *path) override {
+        auto coreInfo = getCoreInfo();
+        if ((coreInfo->flags & FLAG_AQPLUS) == 0 || coreInfo->versionMajor >= 2)
+            return ERR_PARAM;
+
+        auto vfs = getSDCardVFS();
+        int  fd  = vfs->open(FO_RDONLY, path);
+        if (fd < 0)
+            return fd;
+
+        uint8_t header[5];
+        if (vfs->read(fd, sizeof(header), header) != (int)sizeof(header) || memcmp(header, "AQSS", 4) != 0 || header[4] != STATE_VERSION) {
+            vfs->close(fd);
+            return ERR_PARAM;
+        }
+
+        int64_t              tStart = esp_timer_get_time();
+        std::vector<uint8_t> raw(16384);
+        std::vector<uint8_t> packed;
+        unsigned             id;
+        size_t               length;
+
+        // First pass: check the whole file before touching the machine
+        uint8_t stateRegValues[sizeof(stateRegs)];
+        bool    haveRegs = false;
+        while (true) {
+            if (!readStateRecord(vfs, fd, packed, raw, id, length) || (id != STATE_REC_END && !isValidStateRecord(id, length))) {
+                vfs->close(fd);
+                return ERR_PARAM;
+            }
+            if (id == STATE_REC_END)
+                break;
+            if (id == STATE_REC_REGS) {
+                memcpy(stateRegValues, raw.data(), length);
+                haveRegs = true;
+            }
+        }
+        if (!haveRegs || vfs->seek(fd, sizeof(header)) < 0) {
+            vfs->close(fd);
+            return ERR_PARAM;
+        }
+
+        // Second pass: apply records. The FPGA mutex is only held per transfer batch.
+        auto               fpga = FPGA::instance();
+        RecursiveMutexLock busLock(busMutex);
+        int                result = 0;
+
+        aqpAqcuireBus();
+
+        // Registers before the restore, put back when applying fails halfway
+        uint8_t orgRegValues[sizeof(stateRegs)];
+        {
+            RecursiveMutexLock lock(fpga->getMutex());
+            FpgaReply          regs[sizeof(stateRegs)];
+            for (size_t i = 0; i < sizeof(stateRegs); i++)
+                aqpQueueReadIO(stateRegs[i], regs[i]);
+            fpga->spiCmdWait();
+            for (size_t i = 0; i < sizeof(stateRegs); i++)
+                orgRegValues[i] = regs[i].data[1];
+        }
+
+        while (true) {
+            if (!readStateRecord(vfs, fd, packed, raw, id, length)) {
+                // File changed since the first pass
+                result = ERR_OTHER;
+                break;
+            }
+            if (id == STATE_REC_END)
+                break;
+
+            if (id == STATE_REC_PALETTE) {
+                RecursiveMutexLock lock(fpga->getMutex());
+                for (int i = 0; i < 128; i++) {
+                    aqpWriteIO(IO_VPALSEL, i);
+                    aqpWriteIO(IO_VPALDATA, raw[i]);
+                }
+
+            } else if (id == STATE_REC_SPRITES) {
+                RecursiveMutexLock lock(fpga->getMutex());
+                const uint8_t     *p = raw.data();
+                for (int i = 0; i < 64; i++) {
+                    aqpWriteIO(IO_VSPRSEL, i);
+                    for (size_t j = 0; j < sizeof(spriteRegs); j++)
+                        aqpWriteIO(spriteRegs[j], *(p++));
+                }
+
+            } else if (id == STATE_REC_TEXT) {
+                uint8_t vctrl = stateRegValues[0];
+                aqpWriteIO(IO_BANK0, (3 << 6) | 0);
+                aqpWriteIO(IO_VCTRL, vctrl & ~0x80);
+                aqpWriteMemBlock(0x3000, raw.data(), 2048);
+                aqpWriteIO(IO_VCTRL, vctrl | 0x80);
+                aqpWriteMemBlock(0x3000, raw.data() + 2048, 2048);
+
+            } else if (id != STATE_REC_REGS) {
+                aqpWriteIO(IO_BANK0, id);
+                aqpWriteMemBlock(0, raw.data(), length);
+            }
+        }
+        vfs->close(fd);
+
+        // Registers are written back last
+        {
+            const uint8_t     *regValues = (result == 0) ? stateRegValues : orgRegValues;
+            RecursiveMutexLock lock(fpga->getMutex());
+            for (size_t i = 0; i < sizeof(stateRegs); i++)
+                aqpWriteIO(stateRegs[i], regValues[i]);
+            aqpReleaseBus();
+            fpga->spiCmdWait();
+        }
+
+        if (result != 0) {
+            // Memory is partly overwritten, the running program can't continue
+            ESP_LOGE(TAG, "Error applying state, resetting core");
+            resetCore();
+            return result;
+        }
+        ESP_LOGI(TAG, "State loaded in %u ms", (unsigned)((esp_timer_get_time() - tStart) / 1000));
+        return 0;
+    }
+
+    // BASIC is at its prompt when the cursor is at the start of the line below "Ok"
+    bool aqpAtBasicPrompt() {
+        auto               fpga = FPGA::instance();
+        RecursiveMutexLock lock(fpga->getMutex());
+
+        aqpAqcuireBus();
+        uint8_t cursor[3];
+        aqpReadMemBlock(BASIC_TTYPOS, cursor, sizeof(cursor));
+        uint16_t curram  = cursor[1] | (cursor[2] << 8);
+        uint8_t  text[2] = {0, 0};
+        if (cursor[0] == 0 && curram >= SCREEN_RAM + 2 * SCREEN_COLUMNS && curram < SCREEN_RAM + SCREEN_ROWS * SCREEN_COLUMNS)
+            aqpReadMemBlock(curram - SCREEN_COLUMNS, text, sizeof(text));
+        aqpReleaseBus();
+        fpga->spiCmdWait();
+
+        return memcmp(text, "Ok", 2) == 0;
+    }
+
+    // Reset the core and wait until BASIC shows its prompt. Don't hold the FPGA mutex
+    // when calling this, the start screen is bypassed by the timer typing a key.
+    bool aqpResetToBasicPrompt() {
+        resetCore();
+        {
+            // Also bypass the start screen when that isn't enabled in the settings
+            RecursiveMutexLock lock(mutex);
+            xTimerReset(bypassStartTimer, pdMS_TO_TICKS(CONFIG_BYPASS_START_TIME_MS));
+        }
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_BYPASS_START_TIME_MS));
+
+        for (int i = 0; i < 30; i++) {
+            vTaskDelay(pdMS_TO_TICKS(100));
+            if (aqpAtBasicPrompt())
+                return true;
+        }
+        ESP_LOGE(TAG, "Timeout waiting for BASIC prompt");
+        return false;
+    }
+
+    int runProgram(const char *path) override {
+        auto coreInfo = getCoreInfo();
+        if ((coreInfo->flags & FLAG_AQPLUS) == 0 || coreInfo->versionMajor >= 2)
+            return ERR_PARAM;
+
+        const char *ext = strrchr(path, '.');
+        if (!ext)
+            return ERR_PARAM;
+        bool isCaq = strcasecmp(ext, ".caq") == 0;
+        bool isRom = strcasecmp(ext, ".bin") == 0 || strcasecmp(ext, ".rom") == 0;
+        if (!isCaq && !isRom)
+            return ERR_PARAM;
+
+        // Read file
+        auto        vfs = getSDCardVFS();
+        struct stat st;
+        int         result = vfs->stat(path, &st);
+        if (result < 0)
+            return result;
+        if (st.st_size <= 0 || st.st_size > 0x10000 - BASIC_TXTTAB)
+            return ERR_PARAM;
+
+        std::vector<uint8_t> buf(st.st_size);
+        int                  fd = vfs->open(FO_RDONLY, path);
+        if (fd < 0)
+            return fd;
+        result = vfs->read(fd, buf.size(), buf.data());
+        vfs->close(fd);
+        if (result != (int)buf.size())
+            return result < 0 ? result : ERR_OTHER;
+
+        // The FPGA mutex is only held per transfer batch, as the BASIC prompt is awaited without it
+        auto               fpga = FPGA::instance();
+        RecursiveMutexLock busLock(busMutex);
+        int64_t            tStart;
+
+        if (isCaq) {
+            // Header: sync, 6 character name, sync, followed by tokenized BASIC program
+            size_t offset = 0;
+            if (!skipCaqSync(buf, offset) || buf.size() - offset < 6)
+                return ERR_PARAM;
+            if (memcmp(&buf[offset], "######", 6) == 0) {
+                // Array data, not a program
+                return ERR_PARAM;
+            }
+            offset += 6;
+            if (!skipCaqSync(buf, offset))
+                return ERR_PARAM;
+
+            // Follow line links to find the end of the program
+            const uint8_t *prog   = &buf[offset];
+            size_t         maxLen = buf.size() - offset;
+            size_t         len    = 0;
+            while (true) {
+                if (len + 2 > maxLen)
+                    return ERR_PARAM;
+                unsigned link = prog[len] | (prog[len + 1] << 8);
+                if (link == 0) {
+                    len += 2;
+                    break;
+                }
+                if (link <= BASIC_TXTTAB + len || link - BASIC_TXTTAB > maxLen)
+                    return ERR_PARAM;
+                len = link - BASIC_TXTTAB;
+            }
+
+            // The program is stored underneath BASIC, so start from a freshly reset machine
+            if (!aqpResetToBasicPrompt())
+                return ERR_OTHER;
+            tStart = esp_timer_get_time();
+
+            // Store program and update the BASIC variable, array and string pointers
+            uint16_t end    = BASIC_TXTTAB + len;
+            uint8_t  ptrs[] = {(uint8_t)(end & 0xFF), (uint8_t)(end >> 8), (uint8_t)(end & 0xFF), (uint8_t)(end >> 8), (uint8_t)(end & 0xFF), (uint8_t)(end >> 8)};
+
+            aqpAqcuireBus();
+            aqpWriteMemBlock(BASIC_TXTTAB, prog, len);
+            aqpWriteMemBlock(BASIC_VARTAB, ptrs, sizeof(ptrs));
+            aqpReleaseBus();
+            fpga->spiCmdWait();
+
+            // Start program from the BASIC prompt
+            for (const char *p = "RUN\r"; *p; p++)
+                aqpWriteKeybBuffer(*p);
+
+        } else {
+            // Cartridge image, 8KB images are mirrored in the upper half of the page
+            if (buf.size() != 8192 && buf.size() != 16384)
+                return ERR_PARAM;
+            tStart = esp_timer_get_time();
+
+            aqpAqcuireBus();
+            uint8_t bank0 = aqpReadIO(IO_BANK0);
+            aqpWriteIO(IO_BANK0, 19);
+            aqpWriteMemBlock(0, buf.data(), buf.size());
+            if (buf.size() == 8192)
+                aqpWriteMemBlock(8192, buf.data(), buf.size());
+            aqpWriteIO(IO_BANK0, bank0);
+            aqpReleaseBus();
+            fpga->spiCmdWait();
+
+            // The system ROM starts the cartridge on reset
+            resetCore();
+        }
+
+        ESP_LOGI(TAG, "Program loaded in %u ms (%u bytes)", (unsigned)((esp_timer_get_time() - tStart) / 1000), (unsigned)buf.size());
+        return 0;
+    }
+
+    void menuRunProgram(Menu &menu) {
+        FileListMenu fileMenu;
+        fileMenu.title    = "Run program";
+        fileMenu.onSelect = [this, &menu](const std::string &path) {
+            menu.drawMessage("Loading program");
+            if (runProgram(path.c_str()) != 0) {
+                menu.drawMessage("Error loading program");
+                vTaskDelay(pdMS_TO_TICKS(2000));
+            }
+        };
+        fileMenu.show();
+    }
+
+    void menuSaveState(Menu &menu) {
+        std::string fileName = "state.aqs";
+        if (!menu.editString("Enter filename for save state", fileName, 32))
+            return;
+
+        menu.drawMessage("Saving state");
+        int result = saveState(fileName.c_str());
+        menu.drawMessage(result == 0 ? "State saved" : "Error saving state");
+        vTaskDelay(pdMS_TO_TICKS(result == 0 ? 1000 : 2000));
+    }
 #endif
 
     void addMainMenuItems(Menu &menu) override {
@@ -541,6 +1133,14 @@ public:
                 auto &item   = menu.items.emplace_back(MenuItemType::subMenu, "Dump cartridge");
                 item.onEnter = [this, &menu]() { dumpCartridge(menu); };
             }
+            {
+                auto &item   = menu.items.emplace_back(MenuItemType::subMenu, "Run program (.caq/.rom/.bin)");
+                item.onEnter = [this, &menu]() { menuRunProgram(menu); };
+            }
+            {
+                auto &item   = menu.items.emplace_back(MenuItemType::subMenu, "Save state");
+                item.onEnter = [this, &menu]() { menuSaveState(menu); };
+            }
             menu.items.emplace_back(MenuItemType::separator);
         }
 #endif
@@ -0,0 +1,66 @@
+#include "CoreCache.h"
+#include <algorithm>
+
+static const char *TAG = "CoreCache";
+
+CoreCache *CoreCache::instance() {
+    static CoreCache obj;
+    return &obj;
+}
+
+bool CoreCache::lookup(const std::string &path, const struct stat &st, const void **data, size_t *length) {
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        if (it->path != path)
+            continue;
+
+        if (it->mtime != st.st_mtime || it->fileSize != st.st_size) {
+            // File changed, drop stale entry
+            totalSize -= it->length;
+            free(it->data);
+            entries.erase(it);
+            return false;
+        }
+
+        // Move to front
+        std::rotate(entries.begin(), it, it + 1);
+        *data   = entries.front().data;
+        *length = entries.front().length;
+        return true;
+    }
+    return false;
+}
+
+void CoreCache::insert(const std::string &path, const struct stat &st, void *data, size_t length) {
+    if (length > CORE_CACHE_SIZE) {
+        free(data);
+        return;
+    }
+
+    // Remove old entry for this path and evict least recently used entries until the new one fits
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (it->path == path) {
+            totalSize -= it->length;
+            free(it->data);
+            it = entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    while (!entries.empty() && totalSize + length > CORE_CACHE_SIZE) {
+        ESP_LOGI(TAG, "Evicting %s", entries.back().path.c_str());
+        totalSize -= entries.back().length;
+        free(entries.back().data);
+        entries.pop_back();
+    }
+
+    entries.insert(entries.begin(), Entry{path, st.st_mtime, st.st_size, data, length});
+    totalSize += length;
+    ESP_LOGI(TAG, "Cached %s (%u bytes, %u bytes total)", path.c_str(), (unsigned)length, (unsigned)totalSize);
+}
+
+void CoreCache::clear() {
+    for (auto &entry : entries)
+        free(entry.data);
+    entries.clear();
+    totalSize = 0;
+}
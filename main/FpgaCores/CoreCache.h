@@ -0,0 +1,28 @@
+#pragma once
+
+#include "Common.h"
+
+#define CORE_CACHE_SIZE (CONFIG_CORE_CACHE_SIZE_KB * 1024)
+
+// Cache of recently loaded (decompressed) bitstreams, keyed by path, mtime and size.
+// Not thread-safe by itself, callers hold the FPGA mutex.
+class CoreCache {
+public:
+    static CoreCache *instance();
+
+    bool lookup(const std::string &path, const struct stat &st, const void **data, size_t *length);
+    void insert(const std::string &path, const struct stat &st, void *data, size_t length);
+    void clear();
+
+private:
+    struct Entry {
+        std::string path;
+        time_t      mtime;
+        off_t       fileSize;
+        void       *data;
+        size_t      length;
+    };
+
+    std::vector<Entry> entries; // Most recently used first
+    size_t             totalSize = 0;
+};
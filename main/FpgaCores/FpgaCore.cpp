@@ -1,9 +1,12 @@
 #include "FpgaCore.h"
 #include "FPGA.h"
 #include "xz.h"
+#include "lz4.h"
+#include "CoreCache.h"
 #include "DisplayOverlay/DisplayOverlay.h"
 #include "Keyboard.h"
 #include "VFS.h"
+#include <algorithm>
 
 static const char *TAG = "FpgaCore";
 
@@ -25,12 +28,7 @@ void FpgaCore::unload() {
     Keyboard::instance()->reset();
 }
 
-std::shared_ptr<FpgaCore> FpgaCore::load(const void *data, size_t length) {
-    unload();
-
-    if (!FPGA::instance()->loadBitstream(data, length))
-        return nullptr;
-
+std::shared_ptr<FpgaCore> FpgaCore::initCore() {
     FPGA::instance()->getCoreInfo(&coreInfo);
     switch ((FpgaCoreType)coreInfo.coreType) {
         case FpgaCoreType::AquariusPlus: currentCore = newCoreAquariusPlus(); break;
@@ -47,33 +45,178 @@ std::shared_ptr<FpgaCore> FpgaCore::load(const void *data, size_t length) {
     return currentCore;
 }
 
-std::shared_ptr<FpgaCore> FpgaCore::loadCore(const char *path) {
-    auto        vc = VFSContext::getDefault();
+std::shared_ptr<FpgaCore> FpgaCore::load(const void *data, size_t length) {
+    unload();
+
+    if (!FPGA::instance()->loadBitstream(data, length))
+        return nullptr;
+
+    return initCore();
+}
+
+#ifndef EMULATOR
+// Growable buffer holding a copy of the bitstream for the core cache.
+// Running out of memory or exceeding the cache size only disables caching,
+// it doesn't fail the load.
+struct ImageBuffer {
+    uint8_t *data     = nullptr;
+    size_t   size     = 0;
+    size_t   capacity = 0;
+    bool     failed   = (CORE_CACHE_SIZE == 0);
+
+    ~ImageBuffer() { free(data); }
+
+    void fail() {
+        free(data);
+        data   = nullptr;
+        failed = true;
+    }
+
+    void reserve(uint64_t length) {
+        if (failed)
+            return;
+        if (length > CORE_CACHE_SIZE) {
+            fail();
+            return;
+        }
+
+        auto p = (uint8_t *)realloc(data, length);
+        if (!p) {
+            fail();
+            return;
+        }
+        data     = p;
+        capacity = length;
+    }
+
+    void append(const void *buf, size_t length) {
+        if (failed)
+            return;
+        if (size + length > capacity) {
+            // Only without known image size (LZ4 frame without content size)
+            reserve(std::min(std::max(size + length, capacity * 2), (size_t)CORE_CACHE_SIZE));
+            if (failed || size + length > capacity) {
+                fail();
+                return;
+            }
+        }
+        memcpy(data + size, buf, length);
+        size += length;
+    }
+
+    void *release() {
+        // Drop unused capacity before handing the buffer to the cache
+        if (size > 0 && size < capacity) {
+            auto p = (uint8_t *)realloc(data, size);
+            if (p)
+                data = p;
+        }
+        auto p = data;
+        data   = nullptr;
+        return p;
+    }
+};
+
+std::shared_ptr<FpgaCore> FpgaCore::loadFile(const char *path) {
+    unload();
+
+    auto               fpga = FPGA::instance();
+    RecursiveMutexLock lock(fpga->getMutex());
+
+    int64_t tStart = esp_timer_get_time();
+
     struct stat st;
-    int         result = vc->stat(path, &st);
+    int         result = VFSContext::getDefault()->stat(path, &st);
     if (result < 0 || (st.st_mode & S_IFREG) == 0) {
+        ESP_LOGE(TAG, "Bitstream %s not found: %d", path, result);
         return nullptr;
     }
 
-    void *buf = malloc(st.st_size);
-    if (buf == nullptr) {
-        printf("Insufficient memory to allocate buffer for bitstream!\n");
+    // Use cached image if the file didn't change since it was cached
+    auto        cache = CoreCache::instance();
+    const void *cachedData;
+    size_t      cachedLength;
+    if (cache->lookup(path, st, &cachedData, &cachedLength)) {
+        if (!fpga->loadBitstream(cachedData, cachedLength))
+            return nullptr;
+
+        ESP_LOGI(TAG, "Loaded bitstream: %s (%u bytes, cached) in %u ms", path, (unsigned)cachedLength, (unsigned)((esp_timer_get_time() - tStart) / 1000));
+        return initCore();
+    }
+
+    if (!fpga->startBitstream())
+        return nullptr;
+
+    // Stream the bitstream in small chunks instead of reading the whole file into memory.
+    // LZ4 compressed files are detected by their magic and decompressed on the fly.
+    ImageBuffer image;
+    auto writeBitstream = [&](const void *buf, size_t length) {
+        image.append(buf, length);
+        return fpga->writeBitstream(buf, length);
+    };
+
+    std::unique_ptr<Lz4Decoder> lz4;
+    bool                        first    = true;
+    size_t                      fileSize = 0;
+
+    result = VFSContext::getDefault()->readFileChunked(
+        path, 4096, [&](const void *buf, size_t length) {
+            if (first) {
+                // Size the cache copy for the decompressed image, when known up front
+                first = false;
+                if (Lz4Decoder::isLz4(buf, length)) {
+                    lz4 = std::make_unique<Lz4Decoder>(writeBitstream);
+
+                    uint64_t contentSize;
+                    if (Lz4Decoder::getContentSize(buf, length, &contentSize))
+                        image.reserve(contentSize);
+                } else {
+                    image.reserve(st.st_size);
+                }
+            }
+            return lz4 ? lz4->write(buf, length) : writeBitstream(buf, length);
+        },
+        &fileSize);
+    if (result == 0 && lz4 && !lz4->finish())
+        result = ERR_OTHER;
+    if (result < 0) {
+        ESP_LOGE(TAG, "Error reading bitstream %s: %d", path, result);
         return nullptr;
     }
 
-    int fd = vc->open(FO_RDONLY, path);
-    if (fd < 0) {
+    if (!fpga->finishBitstream())
         return nullptr;
+
+    unsigned elapsedMs = (unsigned)((esp_timer_get_time() - tStart) / 1000);
+    if (lz4) {
+        ESP_LOGI(TAG, "Loaded bitstream: %s (%u -> %u bytes, lz4) in %u ms", path, (unsigned)fileSize, (unsigned)lz4->getOutputSize(), elapsedMs);
+    } else {
+        ESP_LOGI(TAG, "Loaded bitstream: %s (%u bytes) in %u ms", path, (unsigned)fileSize, elapsedMs);
     }
-    vc->read(fd, st.st_size, buf);
-    vc->close(fd);
 
-    printf("Loading bitstream: %s (%u bytes)\n", path, (unsigned)st.st_size);
+    if (!image.failed) {
+        size_t length = image.size;
+        cache->insert(path, st, image.release(), length);
+    }
+
+    return initCore();
+}
+#endif
+
+std::shared_ptr<FpgaCore> FpgaCore::loadCore(const char *path) {
+    auto vc = VFSContext::getDefault();
 
 #ifdef EMULATOR
+    struct stat st;
+    int         result = vc->stat(path, &st);
+    if (result < 0 || (st.st_mode & S_IFREG) == 0) {
+        return nullptr;
+    }
+
+    printf("Loading bitstream: %s (%u bytes)\n", path, (unsigned)st.st_size);
     auto newCore = FpgaCore::load(path, st.st_size);
 #else
-    auto newCore = FpgaCore::load(buf, st.st_size);
+    auto newCore = FpgaCore::loadFile(path);
 #endif
     if (!newCore) {
         printf("Failed! Loading default bitstream\n");
@@ -81,7 +224,6 @@ std::shared_ptr<FpgaCore> FpgaCore::loadCore(const char *path) {
         // Restore Aq+ firmware
         newCore = FpgaCore::loadAqPlus();
     }
-    free(buf);
 
     vc->closeAll();
 
@@ -89,25 +231,19 @@ std::shared_ptr<FpgaCore> FpgaCore::loadCore(const char *path) {
 }
 
 std::shared_ptr<FpgaCore> FpgaCore::loadAqPlus() {
+#if !defined(EMULATOR) && defined(CONFIG_MACHINE_TYPE_AQPLUS)
+    return loadFile("esp:aqplus.core");
+#else
     const void *data   = "aqplus.core";
     size_t      length = 0;
 
 #ifndef EMULATOR
-#ifdef CONFIG_MACHINE_TYPE_AQPLUS
-    auto [result, fpgaImage] = VFSContext::getDefault()->readFile("esp:aqplus.core");
-    if (result == 0) {
-        data   = fpgaImage.data();
-        length = fpgaImage.size();
-    } else {
-        ESP_LOGE(TAG, "readFile returned: %d", result);
-    }
-#else
     extern const uint8_t fpgaImageStart[] asm("_binary_morphbook_aqplus_impl1_bit_start");
     extern const uint8_t fpgaImageEnd[] asm("_binary_morphbook_aqplus_impl1_bit_end");
     data   = fpgaImageStart;
     length = fpgaImageEnd - fpgaImageStart;
-#endif
 #endif
 
     return load(data, length);
+#endif
 }
@@ -3,6 +3,7 @@
 #include "Common.h"
 #include "DisplayOverlay/Menu.h"
 #include "FPGA.h"
+#include "VFS.h"
 
 struct GamePadData {
     int8_t   lx, ly;
@@ -22,10 +23,15 @@ class FpgaCore {
 public:
     virtual void resetCore() {}
     virtual bool keyScancode(uint8_t modifiers, unsigned scanCode, bool keyDown) { return false; }
+    virtual void keyBatchBegin() {}
+    virtual void keyBatchEnd() {}
     virtual void keyChar(uint8_t ch, bool isRepeat, uint8_t modifiers) {}
     virtual void mouseReport(int dx, int dy, uint8_t buttonMask, int dWheel, bool absPos = false) {}
     virtual void gamepadReport(unsigned idx, const GamePadData &data) {}
     virtual int  uartCommand(uint8_t cmd, const uint8_t *buf, size_t len) { return -1; }
+    virtual int  saveState(const char *path) { return ERR_PARAM; }
+    virtual int  loadState(const char *path) { return ERR_PARAM; }
+    virtual int  runProgram(const char *path) { return ERR_PARAM; }
     virtual void addMainMenuItems(Menu &menu)                    = 0;
     virtual bool getGamePadData(unsigned idx, GamePadData &data) = 0;
 
@@ -37,6 +43,9 @@ public:
     static const CoreInfo           *getCoreInfo();
 
 private:
+    static std::shared_ptr<FpgaCore> loadFile(const char *path);
+    static std::shared_ptr<FpgaCore> initCore();
+
     static CoreInfo coreInfo;
 };
 
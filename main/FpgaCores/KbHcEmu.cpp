@@ -4,15 +4,111 @@
 
 #include "AqKeyboardDefs.h"
 #include "DisplayOverlay/FileListMenu.h"
+#include "HIDReportHandlerGamepad.h"
 #include "Keyboard.h"
 #include "UartProtocol.h"
 #include "VFS.h"
 
+#include <array>
 #include <math.h>
 #include <nvs_flash.h>
 
+// Keyboard hand controller buttons
+enum {
+    HC_UP    = (1 << 0),
+    HC_DOWN  = (1 << 1),
+    HC_LEFT  = (1 << 2),
+    HC_RIGHT = (1 << 3),
+    HC_K1    = (1 << 4),
+    HC_K2    = (1 << 5),
+    HC_K3    = (1 << 6),
+    HC_K4    = (1 << 7),
+    HC_K5    = (1 << 8),
+    HC_K6    = (1 << 9),
+};
+
+// Scancode to Aquarius keyboard matrix mask
+static constexpr std::array<uint64_t, 256> makeKeyMatrixLut() {
+    struct {
+        uint8_t  scanCode;
+        uint64_t mask;
+    } const map[] = {
+        {SCANCODE_EQUALS, 1ULL << KEY_EQUALS},
+        {SCANCODE_BACKSPACE, 1ULL << KEY_BACKSPACE},
+        {SCANCODE_APOSTROPHE, 1ULL << KEY_COLON},
+        {SCANCODE_RETURN, 1ULL << KEY_RETURN},
+        {SCANCODE_SEMICOLON, 1ULL << KEY_SEMICOLON},
+        {SCANCODE_PERIOD, 1ULL << KEY_PERIOD},
+        {SCANCODE_INSERT, 1ULL << KEY_INSERT},
+        {SCANCODE_DELETE, 1ULL << KEY_DELETE},
+        {SCANCODE_MINUS, 1ULL << KEY_MINUS},
+        {SCANCODE_SLASH, 1ULL << KEY_SLASH},
+        {SCANCODE_0, 1ULL << KEY_0},
+        {SCANCODE_P, 1ULL << KEY_P},
+        {SCANCODE_L, 1ULL << KEY_L},
+        {SCANCODE_COMMA, 1ULL << KEY_COMMA},
+        {SCANCODE_UP, 1ULL << KEY_UP},
+        {SCANCODE_RIGHT, 1ULL << KEY_RIGHT},
+        {SCANCODE_9, 1ULL << KEY_9},
+        {SCANCODE_O, 1ULL << KEY_O},
+        {SCANCODE_K, 1ULL << KEY_K},
+        {SCANCODE_M, 1ULL << KEY_M},
+        {SCANCODE_N, 1ULL << KEY_N},
+        {SCANCODE_J, 1ULL << KEY_J},
+        {SCANCODE_LEFT, 1ULL << KEY_LEFT},
+        {SCANCODE_DOWN, 1ULL << KEY_DOWN},
+        {SCANCODE_8, 1ULL << KEY_8},
+        {SCANCODE_I, 1ULL << KEY_I},
+        {SCANCODE_7, 1ULL << KEY_7},
+        {SCANCODE_U, 1ULL << KEY_U},
+        {SCANCODE_H, 1ULL << KEY_H},
+        {SCANCODE_B, 1ULL << KEY_B},
+        {SCANCODE_HOME, 1ULL << KEY_HOME},
+        {SCANCODE_END, 1ULL << KEY_END},
+        {SCANCODE_6, 1ULL << KEY_6},
+        {SCANCODE_Y, 1ULL << KEY_Y},
+        {SCANCODE_G, 1ULL << KEY_G},
+        {SCANCODE_V, 1ULL << KEY_V},
+        {SCANCODE_C, 1ULL << KEY_C},
+        {SCANCODE_F, 1ULL << KEY_F},
+        {SCANCODE_PAGEUP, 1ULL << KEY_PGUP},
+        {SCANCODE_PAGEDOWN, 1ULL << KEY_PGDN},
+        {SCANCODE_5, 1ULL << KEY_5},
+        {SCANCODE_T, 1ULL << KEY_T},
+        {SCANCODE_4, 1ULL << KEY_4},
+        {SCANCODE_R, 1ULL << KEY_R},
+        {SCANCODE_D, 1ULL << KEY_D},
+        {SCANCODE_X, 1ULL << KEY_X},
+        {SCANCODE_PAUSE, 1ULL << KEY_PAUSE},
+        {SCANCODE_PRINTSCREEN, 1ULL << KEY_PRTSCR},
+        {SCANCODE_3, 1ULL << KEY_3},
+        {SCANCODE_E, 1ULL << KEY_E},
+        {SCANCODE_S, 1ULL << KEY_S},
+        {SCANCODE_Z, 1ULL << KEY_Z},
+        {SCANCODE_SPACE, 1ULL << KEY_SPACE},
+        {SCANCODE_A, 1ULL << KEY_A},
+        {SCANCODE_APPLICATION, 1ULL << KEY_MENU},
+        {SCANCODE_TAB, 1ULL << KEY_TAB},
+        {SCANCODE_2, 1ULL << KEY_2},
+        {SCANCODE_W, 1ULL << KEY_W},
+        {SCANCODE_1, 1ULL << KEY_1},
+        {SCANCODE_Q, 1ULL << KEY_Q},
+
+        // Handle ESCAPE as if CTRL-C is pressed
+        {SCANCODE_ESCAPE, (1ULL << KEY_C) | (1ULL << KEY_CTRL)},
+    };
+
+    std::array<uint64_t, 256> lut = {};
+    for (auto &entry : map)
+        lut[entry.scanCode] = entry.mask;
+    return lut;
+}
+
+static constexpr auto keyMatrixLut = makeKeyMatrixLut();
+
 KbHcEmu::KbHcEmu() {
     memset(gamePads, 0, sizeof(gamePads));
+    buildHandCtrlLut();
 }
 
 void KbHcEmu::loadSettings() {
@@ -38,6 +134,20 @@ void KbHcEmu::loadSettings() {
         }
         nvs_close(h);
     }
+    buildHandCtrlLut();
+}
+
+void KbHcEmu::buildHandCtrlLut() {
+    memset(handCtrlLut, 0, sizeof(handCtrlLut));
+
+    // Filled in reverse priority, so the cursor keys and first matching button win
+    for (int i = 5; i >= 0; i--)
+        handCtrlLut[kb2hcSettings.buttonScanCodes[i]] = HC_K1 << i;
+
+    handCtrlLut[SCANCODE_UP]    = HC_UP;
+    handCtrlLut[SCANCODE_DOWN]  = HC_DOWN;
+    handCtrlLut[SCANCODE_LEFT]  = HC_LEFT;
+    handCtrlLut[SCANCODE_RIGHT] = HC_RIGHT;
 }
 
 bool KbHcEmu::handControllerEmulate(unsigned scanCode, bool keyDown) {
@@ -45,152 +155,49 @@ bool KbHcEmu::handControllerEmulate(unsigned scanCode, bool keyDown) {
     if (!kb2hcSettings.enabled)
         return false;
 
-    bool result = true;
-
-    enum {
-        UP    = (1 << 0),
-        DOWN  = (1 << 1),
-        LEFT  = (1 << 2),
-        RIGHT = (1 << 3),
-        K1    = (1 << 4),
-        K2    = (1 << 5),
-        K3    = (1 << 6),
-        K4    = (1 << 7),
-        K5    = (1 << 8),
-        K6    = (1 << 9),
-    };
-
-    if (scanCode == SCANCODE_UP)
-        keybHandCtrl1Pressed = keyDown ? (keybHandCtrl1Pressed | UP) : (keybHandCtrl1Pressed & ~UP);
-    else if (scanCode == SCANCODE_DOWN)
-        keybHandCtrl1Pressed = keyDown ? (keybHandCtrl1Pressed | DOWN) : (keybHandCtrl1Pressed & ~DOWN);
-    else if (scanCode == SCANCODE_LEFT)
-        keybHandCtrl1Pressed = keyDown ? (keybHandCtrl1Pressed | LEFT) : (keybHandCtrl1Pressed & ~LEFT);
-    else if (scanCode == SCANCODE_RIGHT)
-        keybHandCtrl1Pressed = keyDown ? (keybHandCtrl1Pressed | RIGHT) : (keybHandCtrl1Pressed & ~RIGHT);
-    else if (scanCode == kb2hcSettings.buttonScanCodes[0])
-        keybHandCtrl1Pressed = keyDown ? (keybHandCtrl1Pressed | K1) : (keybHandCtrl1Pressed & ~K1);
-    else if (scanCode == kb2hcSettings.buttonScanCodes[1])
-        keybHandCtrl1Pressed = keyDown ? (keybHandCtrl1Pressed | K2) : (keybHandCtrl1Pressed & ~K2);
-    else if (scanCode == kb2hcSettings.buttonScanCodes[2])
-        keybHandCtrl1Pressed = keyDown ? (keybHandCtrl1Pressed | K3) : (keybHandCtrl1Pressed & ~K3);
-    else if (scanCode == kb2hcSettings.buttonScanCodes[3])
-        keybHandCtrl1Pressed = keyDown ? (keybHandCtrl1Pressed | K4) : (keybHandCtrl1Pressed & ~K4);
-    else if (scanCode == kb2hcSettings.buttonScanCodes[4])
-        keybHandCtrl1Pressed = keyDown ? (keybHandCtrl1Pressed | K5) : (keybHandCtrl1Pressed & ~K5);
-    else if (scanCode == kb2hcSettings.buttonScanCodes[5])
-        keybHandCtrl1Pressed = keyDown ? (keybHandCtrl1Pressed | K6) : (keybHandCtrl1Pressed & ~K6);
-    else
-        result = false;
+    uint16_t button = (scanCode < 256) ? handCtrlLut[scanCode] : 0;
+    if (button)
+        keybHandCtrl1Pressed = keyDown ? (keybHandCtrl1Pressed | button) : (keybHandCtrl1Pressed & ~button);
 
     switch (keybHandCtrl1Pressed & 0xF) {
-        case LEFT: keybHandCtrl1 &= ~(1 << 3); break;
-        case UP | LEFT: keybHandCtrl1 &= ~((1 << 4) | (1 << 3) | (1 << 2)); break;
-        case UP: keybHandCtrl1 &= ~(1 << 2); break;
-        case UP | RIGHT: keybHandCtrl1 &= ~((1 << 4) | (1 << 2) | (1 << 1)); break;
-        case RIGHT: keybHandCtrl1 &= ~(1 << 1); break;
-        case DOWN | RIGHT: keybHandCtrl1 &= ~((1 << 4) | (1 << 1) | (1 << 0)); break;
-        case DOWN: keybHandCtrl1 &= ~(1 << 0); break;
-        case DOWN | LEFT: keybHandCtrl1 &= ~((1 << 4) | (1 << 3) | (1 << 0)); break;
+        case HC_LEFT: keybHandCtrl1 &= ~(1 << 3); break;
+        case HC_UP | HC_LEFT: keybHandCtrl1 &= ~((1 << 4) | (1 << 3) | (1 << 2)); break;
+        case HC_UP: keybHandCtrl1 &= ~(1 << 2); break;
+        case HC_UP | HC_RIGHT: keybHandCtrl1 &= ~((1 << 4) | (1 << 2) | (1 << 1)); break;
+        case HC_RIGHT: keybHandCtrl1 &= ~(1 << 1); break;
+        case HC_DOWN | HC_RIGHT: keybHandCtrl1 &= ~((1 << 4) | (1 << 1) | (1 << 0)); break;
+        case HC_DOWN: keybHandCtrl1 &= ~(1 << 0); break;
+        case HC_DOWN | HC_LEFT: keybHandCtrl1 &= ~((1 << 4) | (1 << 3) | (1 << 0)); break;
         default: break;
     }
-    if (keybHandCtrl1Pressed & K1)
+    if (keybHandCtrl1Pressed & HC_K1)
         keybHandCtrl1 &= ~(1 << 6);
-    if (keybHandCtrl1Pressed & K2)
+    if (keybHandCtrl1Pressed & HC_K2)
         keybHandCtrl1 &= ~((1 << 7) | (1 << 2));
-    if (keybHandCtrl1Pressed & K3)
+    if (keybHandCtrl1Pressed & HC_K3)
         keybHandCtrl1 &= ~((1 << 7) | (1 << 5));
-    if (keybHandCtrl1Pressed & K4)
+    if (keybHandCtrl1Pressed & HC_K4)
         keybHandCtrl1 &= ~(1 << 5);
-    if (keybHandCtrl1Pressed & K5)
+    if (keybHandCtrl1Pressed & HC_K5)
         keybHandCtrl1 &= ~((1 << 7) | (1 << 1));
-    if (keybHandCtrl1Pressed & K6)
+    if (keybHandCtrl1Pressed & HC_K6)
         keybHandCtrl1 &= ~((1 << 7) | (1 << 0));
 
-    return result;
+    return button != 0;
 }
 
 bool KbHcEmu::keyScancode(uint8_t modifiers, unsigned scanCode, bool keyDown) {
     // Hand controller emulation
     if (handControllerEmulate(scanCode, keyDown)) {
-        if (updateHandCtrl)
+        if (batching)
+            handCtrlPending = true;
+        else if (updateHandCtrl)
             updateHandCtrl(gamePadHandCtrl[0] & keybHandCtrl1, gamePadHandCtrl[1]);
         return true;
     }
 
     // Keyboard matrix emulation
     {
-        int key = -1;
-        switch (scanCode) {
-            case SCANCODE_EQUALS: key = KEY_EQUALS; break;
-            case SCANCODE_BACKSPACE: key = KEY_BACKSPACE; break;
-            case SCANCODE_APOSTROPHE: key = KEY_COLON; break;
-            case SCANCODE_RETURN: key = KEY_RETURN; break;
-            case SCANCODE_SEMICOLON: key = KEY_SEMICOLON; break;
-            case SCANCODE_PERIOD: key = KEY_PERIOD; break;
-            case SCANCODE_INSERT: key = KEY_INSERT; break;
-            case SCANCODE_DELETE: key = KEY_DELETE; break;
-            case SCANCODE_MINUS: key = KEY_MINUS; break;
-            case SCANCODE_SLASH: key = KEY_SLASH; break;
-            case SCANCODE_0: key = KEY_0; break;
-            case SCANCODE_P: key = KEY_P; break;
-            case SCANCODE_L: key = KEY_L; break;
-            case SCANCODE_COMMA: key = KEY_COMMA; break;
-            case SCANCODE_UP: key = KEY_UP; break;
-            case SCANCODE_RIGHT: key = KEY_RIGHT; break;
-            case SCANCODE_9: key = KEY_9; break;
-            case SCANCODE_O: key = KEY_O; break;
-            case SCANCODE_K: key = KEY_K; break;
-            case SCANCODE_M: key = KEY_M; break;
-            case SCANCODE_N: key = KEY_N; break;
-            case SCANCODE_J: key = KEY_J; break;
-            case SCANCODE_LEFT: key = KEY_LEFT; break;
-            case SCANCODE_DOWN: key = KEY_DOWN; break;
-            case SCANCODE_8: key = KEY_8; break;
-            case SCANCODE_I: key = KEY_I; break;
-            case SCANCODE_7: key = KEY_7; break;
-            case SCANCODE_U: key = KEY_U; break;
-            case SCANCODE_H: key = KEY_H; break;
-            case SCANCODE_B: key = KEY_B; break;
-            case SCANCODE_HOME: key = KEY_HOME; break;
-            case SCANCODE_END: key = KEY_END; break;
-            case SCANCODE_6: key = KEY_6; break;
-            case SCANCODE_Y: key = KEY_Y; break;
-            case SCANCODE_G: key = KEY_G; break;
-            case SCANCODE_V: key = KEY_V; break;
-            case SCANCODE_C: key = KEY_C; break;
-            case SCANCODE_F: key = KEY_F; break;
-            case SCANCODE_PAGEUP: key = KEY_PGUP; break;
-            case SCANCODE_PAGEDOWN: key = KEY_PGDN; break;
-            case SCANCODE_5: key = KEY_5; break;
-            case SCANCODE_T: key = KEY_T; break;
-            case SCANCODE_4: key = KEY_4; break;
-            case SCANCODE_R: key = KEY_R; break;
-            case SCANCODE_D: key = KEY_D; break;
-            case SCANCODE_X: key = KEY_X; break;
-            case SCANCODE_PAUSE: key = KEY_PAUSE; break;
-            case SCANCODE_PRINTSCREEN: key = KEY_PRTSCR; break;
-            case SCANCODE_3: key = KEY_3; break;
-            case SCANCODE_E: key = KEY_E; break;
-            case SCANCODE_S: key = KEY_S; break;
-            case SCANCODE_Z: key = KEY_Z; break;
-            case SCANCODE_SPACE: key = KEY_SPACE; break;
-            case SCANCODE_A: key = KEY_A; break;
-            case SCANCODE_APPLICATION: key = KEY_MENU; break;
-            case SCANCODE_TAB: key = KEY_TAB; break;
-            case SCANCODE_2: key = KEY_2; break;
-            case SCANCODE_W: key = KEY_W; break;
-            case SCANCODE_1: key = KEY_1; break;
-            case SCANCODE_Q: key = KEY_Q; break;
-            default: break;
-        }
-        if (key >= 0) {
-            if (keyDown)
-                keybMatrix |= (1ULL << key);
-            else
-                keybMatrix &= ~(1ULL << key);
-        }
-
         if (modifiers & (ModLShift | ModRShift))
             keybMatrix |= (1ULL << KEY_SHIFT);
         else
@@ -211,27 +218,43 @@ bool KbHcEmu::keyScancode(uint8_t modifiers, unsigned scanCode, bool keyDown) {
         else
             keybMatrix &= ~(1ULL << KEY_GUI);
 
-        // Handle ESCAPE as if CTRL-C is pressed
-        if (scanCode == SCANCODE_ESCAPE) {
-            if (keyDown) {
-                keybMatrix |= (1ULL << KEY_C) | (1ULL << KEY_CTRL);
-            } else {
-                keybMatrix &= ~((1ULL << KEY_C) | (1ULL << KEY_CTRL));
-            }
-        }
+        uint64_t mask = (scanCode < 256) ? keyMatrixLut[scanCode] : 0;
+        keybMatrix    = keyDown ? (keybMatrix | mask) : (keybMatrix & ~mask);
     }
 
+    if (!batching)
+        flushKeybMatrix();
+    return false;
+}
+
+void KbHcEmu::flushKeybMatrix() {
     if (prevMatrix != keybMatrix) {
         // printf("keybMatrix: %016llx\n", keybMatrix);
         if (updateKeybMatrix)
             updateKeybMatrix(~keybMatrix);
         prevMatrix = keybMatrix;
     }
-    return false;
+}
+
+void KbHcEmu::beginBatch() {
+    batching = true;
+}
+
+void KbHcEmu::endBatch() {
+    if (!batching)
+        return;
+    batching = false;
+
+    if (handCtrlPending) {
+        handCtrlPending = false;
+        if (updateHandCtrl)
+            updateHandCtrl(gamePadHandCtrl[0] & keybHandCtrl1, gamePadHandCtrl[1]);
+    }
+    flushKeybMatrix();
 }
 
 void KbHcEmu::gamepadReport(unsigned idx, const GamePadData &data) {
-    if (idx > 1)
+    if (idx >= NUM_PLAYERS)
         return;
 
     uint16_t pressed = (~gamePads[idx].buttons & data.buttons);
@@ -367,7 +390,7 @@ void KbHcEmu::gameCtrlUpdated() {
 }
 
 bool KbHcEmu::getGamePadData(unsigned idx, GamePadData &data) {
-    if (idx > 1)
+    if (idx >= NUM_PLAYERS)
         return false;
 
     data = gamePads[idx];
@@ -379,7 +402,7 @@ void KbHcEmu::cmdGetGameCtrl(uint8_t idx) {
 
     auto up = UartProtocol::instance();
     up->txStart();
-    if (idx > 1) {
+    if (idx >= NUM_PLAYERS) {
         up->txWrite(ERR_NOT_FOUND);
         return;
     }
@@ -442,6 +465,7 @@ void KbHcEmu::addMainMenuItems(Menu &menu) {
             menu.settings = kb2hcSettings;
             menu.onChange = [this, &menu]() {
                 kb2hcSettings = menu.settings;
+                buildHandCtrlLut();
 
                 nvs_handle_t h;
                 if (nvs_open("settings", NVS_READWRITE, &h) == ESP_OK) {
@@ -513,4 +537,9 @@ void KbHcEmu::addMainMenuItems(Menu &menu) {
         };
         item.getter = [this]() { return gamepadNavigation ? 1 : 0; };
     }
+    for (unsigned i = 0; i < NUM_PLAYERS; i++) {
+        auto &item  = menu.items.emplace_back(MenuItemType::percentage, "Gamepad " + std::to_string(i + 1) + " stick dead zone");
+        item.setter = [i](int newVal) { HIDReportHandlerGamepad::setDeadZone(i, newVal); };
+        item.getter = [i]() { return HIDReportHandlerGamepad::getDeadZone(i); };
+    }
 }
@@ -2,6 +2,7 @@
 
 #include "Common.h"
 #include "FpgaCore.h"
+#include "GamepadSlots.h"
 #include "DisplayOverlay/DisplayOverlay.h"
 #include "DisplayOverlay/KeyboardHandCtrlMappingMenu.h"
 #include "DisplayOverlay/GamepadHandCtrlMappingMenu.h"
@@ -17,24 +18,31 @@ public:
     KbHcEmu();
     void loadSettings();
     bool keyScancode(uint8_t modifiers, unsigned scanCode, bool keyDown);
+    void beginBatch();
+    void endBatch();
     void gamepadReport(unsigned idx, const GamePadData &data);
     bool getGamePadData(unsigned idx, GamePadData &data);
     void cmdGetGameCtrl(uint8_t idx);
     void addMainMenuItems(Menu &menu);
 
 private:
-    GamePadData  gamePads[2];
+    GamePadData  gamePads[NUM_PLAYERS];
     uint64_t     prevMatrix           = 0;
     uint64_t     keybMatrix           = 0;
     bool         gamepadNavigation    = false;
     unsigned     keybHandCtrl1Pressed = 0;
     uint8_t      keybHandCtrl1        = 0xFF;
     uint8_t      gamePadHandCtrl[2]   = {0xFF, 0xFF};
+    bool         batching             = false; // Defer matrix/hand controller updates until endBatch
+    bool         handCtrlPending      = false;
     Kb2HcMapping kb2hcSettings; // Keyboard to hand controller mapping
     Gp2HcMapping gp2hcSettings; // Gamepad to hand controller mapping
     Gp2KbMapping gp2kbSettings; // Gamepad to keyboard mapping
+    uint16_t     handCtrlLut[256];  // Scancode to keyboard hand controller buttons, built from kb2hcSettings
 
+    void        buildHandCtrlLut();
     bool        handControllerEmulate(unsigned scanCode, bool keyDown);
+    void        flushKeybMatrix();
     void        gameCtrlUpdated();
     std::string getPresetPath(std::string presetType);
     void        savePreset(Menu &menu, std::string presetType, const void *buf, size_t size);
@@ -0,0 +1,114 @@
+#include "GamepadSlots.h"
+#include "IdxAlloc.h"
+#include "FpgaCore.h"
+#include <atomic>
+
+static const char *TAG = "GamepadSlots";
+
+class GamepadSlotsInt : public GamepadSlots {
+public:
+    IdxAlloc              handles{MAX_GAMEPADS};
+    std::atomic<uint32_t> nextSeq{1};
+    std::atomic<uint32_t> seq[MAX_GAMEPADS];     // Connection order (priority), 0 when handle is free
+    std::atomic<int>      playerPad[NUM_PLAYERS]; // Handle of gamepad in player slot, -1 when free
+
+    GamepadSlotsInt() {
+        for (auto &s : seq)
+            s = 0;
+        for (auto &p : playerPad)
+            p = -1;
+    }
+
+    int add() override {
+        int handle = handles.alloc();
+        if (handle < 0)
+            return -1;
+        seq[handle] = nextSeq++;
+        promote();
+
+        ESP_LOGI(TAG, "Gamepad %d connected, player %d", handle, getPlayer(handle) + 1);
+        return handle;
+    }
+
+    void remove(int handle) override {
+        if (handle < 0 || handle >= MAX_GAMEPADS)
+            return;
+
+        // Clearing the sequence number makes pending promotions of this handle back off
+        seq[handle] = 0;
+
+        for (unsigned player = 0; player < NUM_PLAYERS; player++) {
+            int expected = handle;
+            if (!playerPad[player].compare_exchange_strong(expected, -1))
+                continue;
+
+            ESP_LOGI(TAG, "Gamepad %d disconnected, player %u free", handle, player + 1);
+
+            // Release buttons held on the core
+            auto core = FpgaCore::get();
+            if (core) {
+                GamePadData data;
+                memset(&data, 0, sizeof(data));
+                core->gamepadReport(player, data);
+            }
+        }
+        handles.free(handle);
+        promote();
+    }
+
+    int getPlayer(int handle) override {
+        if (handle < 0)
+            return -1;
+        for (unsigned player = 0; player < NUM_PLAYERS; player++) {
+            if (playerPad[player].load(std::memory_order_relaxed) == handle)
+                return player;
+        }
+        return -1;
+    }
+
+    void promote() override {
+        for (unsigned player = 0; player < NUM_PLAYERS; player++) {
+            while (playerPad[player] < 0) {
+                // Earliest connected gamepad without player slot
+                int      best    = -1;
+                uint32_t bestSeq = 0;
+                for (int i = 0; i < MAX_GAMEPADS; i++) {
+                    uint32_t s = seq[i];
+                    if (s != 0 && (best < 0 || s < bestSeq) && getPlayer(i) < 0) {
+                        best    = i;
+                        bestSeq = s;
+                    }
+                }
+                if (best < 0)
+                    return;
+
+                int expected = -1;
+                if (!playerPad[player].compare_exchange_strong(expected, best))
+                    break;
+
+                // Back off when the gamepad was removed meanwhile, or got a
+                // lower player slot from a concurrent promotion
+                if (seq[best] != bestSeq || getPlayer(best) != (int)player) {
+                    expected = best;
+                    playerPad[player].compare_exchange_strong(expected, -1);
+                    continue;
+                }
+                ESP_LOGI(TAG, "Gamepad %d assigned to player %u", best, player + 1);
+            }
+        }
+    }
+
+    int getCount() override {
+        int result = 0;
+        for (auto &s : seq) {
+            if (s != 0)
+                result++;
+        }
+        return result;
+    }
+};
+
+GamepadSlots *GamepadSlots::instance() {
+    static GamepadSlotsInt obj;
+    return &obj;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "Common.h"
+
+#define MAX_GAMEPADS (8) // Connected gamepads
+#define NUM_PLAYERS  (2) // Gamepad slots of the FPGA core
+
+// Registry of connected gamepads. Gamepads get a player slot in connection
+// order, gamepads connected beyond NUM_PLAYERS wait and are promoted when a
+// player slot is freed. All functions are lock-free.
+class GamepadSlots {
+public:
+    static GamepadSlots *instance();
+
+    virtual int  add()                 = 0; // Returns handle, -1 when too many gamepads are connected
+    virtual void remove(int handle)    = 0; // Releases player slot (buttons are released on the core)
+    virtual int  getPlayer(int handle) = 0; // Returns player slot, -1 when waiting
+    virtual void promote()             = 0; // Fill free player slots with waiting gamepads
+    virtual int  getCount()            = 0;
+};
@@ -1,65 +1,86 @@
 #include "HIDReportDescriptor.h"
-#include <optional>
-
-void HIDItem::dump(bool recurseChildren, int depth) {
-    if (itemType == HIDItem::ItemType::Collection) {
-        auto collection = static_cast<const HIDCollection *>(this);
-
-        const char *typeStr;
-        switch (collection->collectionType) {
-            case HIDCollection::CollectionType::Physical: typeStr = "CP"; break;
-            case HIDCollection::CollectionType::Application: typeStr = "CA"; break;
-            case HIDCollection::CollectionType::Logical: typeStr = "CL"; break;
-            case HIDCollection::CollectionType::Report: typeStr = "Report"; break;
-            case HIDCollection::CollectionType::NamedArray: typeStr = "NARy"; break;
-            case HIDCollection::CollectionType::UsageSwitch: typeStr = "US"; break;
-            case HIDCollection::CollectionType::UsageModifier: typeStr = "UM"; break;
-            default: typeStr = "Unknown"; break;
-        }
-        printf("%*s Collection %s - usage: %04X:%04X\n", depth * 2, "-", typeStr, collection->usagePage, collection->usage);
+
+static unsigned getDepth(const HIDReportDescriptor &desc, unsigned idx) {
+    unsigned depth = 0;
+    while (desc.collections[idx].parent != HIDCollection::noParent) {
+        idx = desc.collections[idx].parent;
+        depth++;
+    }
+    return depth;
+}
+
+static void dumpCollection(const HIDCollection &collection, int depth) {
+    const char *typeStr;
+    switch (collection.collectionType) {
+        case HIDCollection::CollectionType::Physical: typeStr = "CP"; break;
+        case HIDCollection::CollectionType::Application: typeStr = "CA"; break;
+        case HIDCollection::CollectionType::Logical: typeStr = "CL"; break;
+        case HIDCollection::CollectionType::Report: typeStr = "Report"; break;
+        case HIDCollection::CollectionType::NamedArray: typeStr = "NARy"; break;
+        case HIDCollection::CollectionType::UsageSwitch: typeStr = "US"; break;
+        case HIDCollection::CollectionType::UsageModifier: typeStr = "UM"; break;
+        default: typeStr = "Unknown"; break;
+    }
+    printf("%*s Collection %s - usage: %04X:%04X\n", depth * 2, "-", typeStr, collection.usagePage, collection.usage);
+}
+
+static void dumpField(const HIDField &field, int depth) {
+    const char *typeStr;
+    switch (field.type) {
+        case HIDField::Type::Input: typeStr = "Input"; break;
+        case HIDField::Type::Output: typeStr = "Output"; break;
+        case HIDField::Type::Feature: typeStr = "Feature"; break;
+        default: typeStr = "Unknown"; break;
+    }
+
+    if (field.arraySize == 1) {
+        printf(
+            "%*s %s (reportId: %d) bit %d:%d - usage: %X:%X (log. range: %d..%d  phys. range: %d..%d  unit: 0x%02X  unitExponent: %d) attributes: %X\n",
+            depth * 2, "-", typeStr,
+            field.reportID,
+            field.bitIdx, field.bitSize,
+            field.usagePage, field.usageMin,
+            (int)field.logicalMin, (int)field.logicalMax,
+            (int)field.physicalMin, (int)field.physicalMax,
+            (unsigned)field.unit, (int)field.unitExponent,
+            (unsigned)field.attributes);
 
     } else {
-        const HIDField *field = static_cast<const HIDField *>(this);
-
-        const char *typeStr;
-        switch (field->itemType) {
-            case HIDItem::ItemType::InputField: typeStr = "Input"; break;
-            case HIDItem::ItemType::OutputField: typeStr = "Output"; break;
-            case HIDItem::ItemType::FeatureField: typeStr = "Feature"; break;
-            default: typeStr = "Unknown"; break;
-        }
+        printf(
+            "%*s %s (reportId: %d) bit %d:%d (%ux) - usage: %X:%X..%X (log. range: %d..%d  phys. range: %d..%d  unit: 0x%02X  unitExponent: %d) attributes: %X\n",
+            depth * 2, "-", typeStr,
+            field.reportID,
+            field.bitIdx, field.bitSize, (unsigned)field.arraySize,
+            field.usagePage, field.usageMin, field.usageMax,
+            (int)field.logicalMin, (int)field.logicalMax,
+            (int)field.physicalMin, (int)field.physicalMax,
+            (unsigned)field.unit, (int)field.unitExponent,
+            (unsigned)field.attributes);
+    }
+}
 
-        if (field->arraySize == 1) {
-            printf(
-                "%*s %s (reportId: %d) bit %d:%d - usage: %X:%X (log. range: %d..%d  phys. range: %d..%d  unit: 0x%02X  unitExponent: %d) attributes: %X\n",
-                depth * 2, "-", typeStr,
-                field->reportID,
-                field->bitIdx, field->bitSize,
-                field->usagePage, field->usageMin,
-                (int)field->logicalMin, (int)field->logicalMax,
-                (int)field->physicalMin, (int)field->physicalMax,
-                (unsigned)field->unit, (int)field->unitExponent,
-                (unsigned)field->attributes);
-
-        } else {
-            printf(
-                "%*s %s (reportId: %d) bit %d:%d (%ux) - usage: %X:%X..%X (log. range: %d..%d  phys. range: %d..%d  unit: 0x%02X  unitExponent: %d) attributes: %X\n",
-                depth * 2, "-", typeStr,
-                field->reportID,
-                field->bitIdx, field->bitSize, (unsigned)field->arraySize,
-                field->usagePage, field->usageMin, field->usageMax,
-                (int)field->logicalMin, (int)field->logicalMax,
-                (int)field->physicalMin, (int)field->physicalMax,
-                (unsigned)field->unit, (int)field->unitExponent,
-                (unsigned)field->attributes);
+void HIDReportDescriptor::dump() const {
+    size_t ci = 0;
+    for (size_t fi = 0; fi <= fields.size(); fi++) {
+        // Collections opened before this field
+        while (ci < collections.size() && collections[ci].fieldBegin <= fi) {
+            dumpCollection(collections[ci], getDepth(*this, ci));
+            ci++;
         }
-    }
+        if (fi == fields.size())
+            break;
 
-    if (recurseChildren)
-        for (auto subItem : subItems)
-            subItem->dump(recurseChildren, depth + 1);
+        // Innermost collection containing this field
+        int inner = (int)ci - 1;
+        while (inner >= 0 && (fi < collections[inner].fieldBegin || fi >= collections[inner].fieldEnd))
+            inner--;
+
+        dumpField(fields[fi], inner < 0 ? 0 : getDepth(*this, inner) + 1);
+    }
 }
 
+// Single pass parser, fields are appended to one flat vector. Parser state
+// uses fixed size storage or vectors that are reused for every item.
 class HIDReportDescriptorParser {
 public:
     enum class ItemType {
@@ -105,119 +126,118 @@ public:
     };
 
     struct Global {
-        std::optional<uint32_t> usagePage;
-        std::optional<uint32_t> logicalMin;
-        std::optional<uint32_t> logicalMax;
-        std::optional<uint32_t> physicalMin;
-        std::optional<uint32_t> physicalMax;
-        std::optional<int32_t>  unitExponent;
-        std::optional<uint32_t> unit;
-        std::optional<uint32_t> reportSize;
-        std::optional<uint8_t>  reportID;
-        std::optional<uint32_t> reportCount;
+        uint32_t usagePage      = 0;
+        uint32_t logicalMin     = 0;
+        uint32_t logicalMax     = 0;
+        uint32_t physicalMin    = 0;
+        uint32_t physicalMax    = 0;
+        int32_t  unitExponent   = 0;
+        uint32_t unit           = 0;
+        uint32_t reportSize     = 0;
+        uint8_t  reportID       = 0;
+        uint32_t reportCount    = 0;
+        bool     hasReportSize  = false;
+        bool     hasReportCount = false;
     };
 
-    struct Local {
-        struct Usage {
-            Usage(uint32_t _usageMin, uint32_t _usageMax)
-                : usageMin(_usageMin), usageMax(_usageMax) {
-            }
-            uint32_t usageMin;
-            uint32_t usageMax;
-        };
+    struct Usage {
+        uint32_t usageMin;
+        uint32_t usageMax;
+    };
 
+    struct Local {
         std::vector<Usage> usages;
 
-        std::optional<uint32_t> usageMinimum;      // tag 1
-        std::optional<uint32_t> usageMaximum;      // tag 2
-        std::optional<uint32_t> designatorIndex;   // tag 3
-        std::optional<uint32_t> designatorMinimum; // tag 4
-        std::optional<uint32_t> designatorMaximum; // tag 5
-        std::optional<uint32_t> stringIndex;       // tag 7
-        std::optional<uint32_t> stringMinimum;     // tag 8
-        std::optional<uint32_t> stringMaximum;     // tag 9
-        std::optional<uint32_t> delimiter;         // tag 10
+        uint32_t usageMinimum    = 0;
+        uint32_t usageMaximum    = 0;
+        bool     hasUsageMinimum = false;
+        bool     hasUsageMaximum = false;
 
         void clear() {
-            usages.clear();
-            usageMinimum.reset();
-            usageMaximum.reset();
-            designatorIndex.reset();
-            designatorMinimum.reset();
-            designatorMaximum.reset();
-            stringIndex.reset();
-            stringMinimum.reset();
-            stringMaximum.reset();
-            delimiter.reset();
+            usages.clear(); // Keeps capacity
+            hasUsageMinimum = false;
+            hasUsageMaximum = false;
         }
 
         void addUsage(uint32_t minUsage, uint32_t maxUsage) {
-            usages.emplace_back(minUsage, maxUsage);
-            usageMinimum.reset();
-            usageMaximum.reset();
+            usages.push_back({minUsage, maxUsage});
+            hasUsageMinimum = false;
+            hasUsageMaximum = false;
         }
     };
 
-    struct ReportInfo {
-        struct ReportID {
-            ReportID(uint8_t _id) : id(_id) {}
-            uint8_t  id;
-            uint32_t size = 0;
-        };
-
-        std::map<uint8_t, ReportID> reportIDs;
-        bool                        noReportIDs = false;
-
-        ReportID *getReportID(uint8_t id) {
-            // Check if already used
-            auto it = reportIDs.find(id);
-            if (it != reportIDs.end()) {
-                return &it->second;
-            }
-            if (noReportIDs)
-                return nullptr;
+    // Current size of each report, per field type and report ID
+    struct ReportSize {
+        HIDField::Type type;
+        uint8_t        id;
+        uint32_t       size;
+    };
 
-            if (id == 0)
-                noReportIDs = true;
+    static const unsigned maxGlobalStack = 8;
 
-            auto result = reportIDs.emplace(id, id);
-            return &(result.first)->second;
-        }
+    HIDReportDescriptor    &desc;
+    Global                  global;
+    Global                  globalStack[maxGlobalStack];
+    unsigned                globalStackDepth = 0;
+    Local                   local;
+    std::vector<ReportSize> reportSizes;
+    bool                    noReportIDs[3] = {false, false, false};
+    uint16_t                curCollection  = HIDCollection::noParent;
 
-        bool addBits(uint8_t id, uint32_t numBits) {
-            auto reportID = getReportID(id);
-            if (reportID) {
-                reportID->size += numBits;
-                return true;
-            }
-            return false;
-        }
+    HIDReportDescriptorParser(HIDReportDescriptor &_desc) : desc(_desc) {
+        local.usages.reserve(16);
+        reportSizes.reserve(16);
+    }
 
-        bool getBitOffset(uint8_t id, uint32_t &bitOffset) {
-            auto reportID = getReportID(id);
-            if (reportID) {
-                bitOffset = reportID->size;
-                return true;
-            }
-            return false;
+    ReportSize *getReportSize(HIDField::Type type, uint8_t id) {
+        // Check if already used
+        for (auto &rs : reportSizes) {
+            if (rs.type == type && rs.id == id)
+                return &rs;
         }
-    };
+        if (noReportIDs[(int)type])
+            return nullptr;
+
+        if (id == 0)
+            noReportIDs[(int)type] = true;
 
-    Global                                      global;
-    std::vector<Global>                         globalStack;
-    Local                                       local;
-    ReportInfo                                  inputReportInfo;
-    ReportInfo                                  outputReportInfo;
-    ReportInfo                                  featureReportInfo;
-    std::vector<std::shared_ptr<HIDCollection>> collections;
-    std::vector<std::shared_ptr<HIDCollection>> collectionStack;
+        reportSizes.push_back({type, id, 0});
+        return &reportSizes.back();
+    }
+
+    void addField(HIDField::Type type, uint32_t bitIdx, uint32_t bitSize, uint32_t arraySize, uint16_t usagePage, uint16_t usageMin, uint16_t usageMax, uint32_t attributes) {
+        if (curCollection == HIDCollection::noParent)
+            return;
+
+        auto &field        = desc.fields.emplace_back();
+        field.type         = type;
+        field.reportID     = global.reportID;
+        field.usagePage    = usagePage;
+        field.bitIdx       = bitIdx;
+        field.bitSize      = bitSize;
+        field.arraySize    = arraySize;
+        field.usageMin     = usageMin;
+        field.usageMax     = usageMax;
+        field.logicalMin   = global.logicalMin;
+        field.logicalMax   = global.logicalMax;
+        field.physicalMin  = global.physicalMin;
+        field.physicalMax  = global.physicalMax;
+        field.unitExponent = global.unitExponent;
+        field.unit         = global.unit;
+        field.attributes   = attributes;
+
+        if (field.physicalMin == 0 && field.physicalMax == 0) {
+            field.physicalMin = field.logicalMin;
+            field.physicalMax = field.logicalMax;
+        }
+    }
 
     void handleMainItem(MainItemTag tag, unsigned value) {
         // printf("handleMainItem(%u) value=%u\n", (unsigned)tag, value);
 
         // Collection
         if (tag == MainItemTag::Collection) {
-            uint16_t usagePage = global.usagePage.value_or(0);
+            uint16_t usagePage = global.usagePage;
             uint16_t usage     = 0;
 
             if (!local.usages.empty()) {
@@ -227,129 +247,101 @@ public:
                 usage = local.usages[0].usageMin & 0xFFFF;
             }
 
-            // Create new collection
-            auto collection = std::make_shared<HIDCollection>((HIDCollection::CollectionType)value, usagePage, usage);
-            if (collectionStack.empty()) {
-                // This is a top-level collection
-                collections.push_back(collection);
-            } else {
-                collectionStack.back()->subItems.push_back(collection);
-            }
-            collectionStack.push_back(collection);
+            auto &collection          = desc.collections.emplace_back();
+            collection.collectionType = (HIDCollection::CollectionType)value;
+            collection.usagePage      = usagePage;
+            collection.usage          = usage;
+            collection.parent         = curCollection;
+            collection.fieldBegin     = desc.fields.size();
+            collection.fieldEnd       = desc.fields.size();
+            curCollection             = desc.collections.size() - 1;
         }
 
         // End collection
         else if (tag == MainItemTag::EndCollection) {
-            if (!collectionStack.empty())
-                collectionStack.pop_back();
+            if (curCollection != HIDCollection::noParent) {
+                auto &collection    = desc.collections[curCollection];
+                collection.fieldEnd = desc.fields.size();
+                curCollection       = collection.parent;
+            }
         }
 
         // Input/output/feature
         else if (tag == MainItemTag::Input || tag == MainItemTag::Output || tag == MainItemTag::Feature) {
-            uint32_t          attributes = value;
-            HIDItem::ItemType type;
+            uint32_t       attributes = value;
+            HIDField::Type type;
 
-            ReportInfo *reportInfo = nullptr;
             if (tag == MainItemTag::Input) {
-                reportInfo = &inputReportInfo;
-                type       = HIDItem::ItemType::InputField;
+                type = HIDField::Type::Input;
             } else if (tag == MainItemTag::Output) {
-                reportInfo = &outputReportInfo;
-                type       = HIDItem::ItemType::OutputField;
+                type = HIDField::Type::Output;
             } else { // (tag == MainItemTag::Feature)
-                reportInfo = &featureReportInfo;
-                type       = HIDItem::ItemType::FeatureField;
+                type = HIDField::Type::Feature;
             }
 
+            auto reportSize = getReportSize(type, global.reportID);
+
             // Skip constant fields
             if ((attributes & (1 << 0)) == 0) {
-                uint8_t reportID = global.reportID.value_or(0);
-
-                uint32_t bitOffset = 0;
-                if (!reportInfo->getBitOffset(reportID, bitOffset)) {
+                if (!reportSize) {
                     printf("Error in reportID\n");
                 }
-
-                int usagesIdx = 0;
-                if (!local.usages.empty()) {
-                    // Variable
-                    if (attributes & (1 << 1)) {
-                        uint32_t numUsages = 0;
-                        uint32_t curUsage  = 0;
-
-                        for (unsigned i = 0; i < global.reportCount; i++) {
-                            if (numUsages == 0) {
-                                numUsages = (local.usages[usagesIdx].usageMax - local.usages[usagesIdx].usageMin) + 1;
-                                curUsage  = local.usages[usagesIdx].usageMin;
-                            } else {
-                                curUsage++;
-                            }
-
-                            uint16_t usagePage = global.usagePage.value_or(0);
-                            if (curUsage & 0xFFFF0000) {
-                                usagePage = curUsage >> 16;
-                                curUsage &= 0xFFFF;
-                            }
-
-                            // Ignore vendor specific usage pages
-                            if (usagePage < 0xFF00 && global.reportSize.has_value()) {
-                                auto newField = std::make_shared<HIDField>(
-                                    type,
-                                    global.reportID.value_or(0),
-                                    bitOffset + i * global.reportSize.value(), global.reportSize.value(), 1,
-                                    usagePage, curUsage, curUsage,
-                                    global.logicalMin.value_or(0), global.logicalMax.value_or(0),
-                                    global.physicalMin.value_or(0), global.physicalMax.value_or(0),
-                                    global.unitExponent.value_or(0), global.unit.value_or(0),
-                                    attributes);
-
-                                if (!collectionStack.empty()) {
-                                    collectionStack.back()->subItems.push_back(newField);
-                                }
-                            }
-
-                            numUsages--;
-                            if (numUsages == 0) {
-                                if (++usagesIdx == (int)local.usages.size())
-                                    break;
-                            }
+            }
+            if ((attributes & (1 << 0)) == 0 && !local.usages.empty()) {
+                uint32_t bitOffset = reportSize ? reportSize->size : 0;
+
+                // Variable
+                if (attributes & (1 << 1)) {
+                    unsigned usagesIdx = 0;
+                    uint32_t numUsages = 0;
+                    uint32_t curUsage  = 0;
+
+                    for (unsigned i = 0; i < global.reportCount; i++) {
+                        if (numUsages == 0) {
+                            numUsages = (local.usages[usagesIdx].usageMax - local.usages[usagesIdx].usageMin) + 1;
+                            curUsage  = local.usages[usagesIdx].usageMin;
+                        } else {
+                            curUsage++;
                         }
-                    }
 
-                    // Array
-                    else {
-                        uint16_t usagePage = global.usagePage.value_or(0);
-                        uint32_t usageMin  = local.usages[0].usageMin;
-                        uint32_t usageMax  = local.usages[0].usageMax;
-
-                        if (usageMin & 0xFFFF0000) {
-                            usagePage = usageMin >> 16;
-                            usageMin &= 0xFFFF;
-                            usageMax &= 0xFFFF;
+                        uint16_t usagePage = global.usagePage;
+                        if (curUsage & 0xFFFF0000) {
+                            usagePage = curUsage >> 16;
+                            curUsage &= 0xFFFF;
                         }
 
                         // Ignore vendor specific usage pages
-                        if (usagePage < 0xFF00 && global.reportSize.has_value() && global.reportCount.has_value()) {
-                            auto newField = std::make_shared<HIDField>(
-                                type,
-                                global.reportID.value_or(0),
-                                bitOffset, global.reportSize.value(), global.reportCount.value(),
-                                usagePage, usageMin, usageMax,
-                                global.logicalMin.value_or(0), global.logicalMax.value_or(0),
-                                global.physicalMin.value_or(0), global.physicalMax.value_or(0),
-                                global.unitExponent.value_or(0), global.unit.value_or(0),
-                                attributes);
-
-                            if (!collectionStack.empty()) {
-                                collectionStack.back()->subItems.push_back(newField);
-                            }
+                        if (usagePage < 0xFF00 && global.hasReportSize)
+                            addField(type, bitOffset + i * global.reportSize, global.reportSize, 1, usagePage, curUsage, curUsage, attributes);
+
+                        numUsages--;
+                        if (numUsages == 0) {
+                            if (++usagesIdx == local.usages.size())
+                                break;
                         }
                     }
                 }
+
+                // Array
+                else {
+                    uint16_t usagePage = global.usagePage;
+                    uint32_t usageMin  = local.usages[0].usageMin;
+                    uint32_t usageMax  = local.usages[0].usageMax;
+
+                    if (usageMin & 0xFFFF0000) {
+                        usagePage = usageMin >> 16;
+                        usageMin &= 0xFFFF;
+                        usageMax &= 0xFFFF;
+                    }
+
+                    // Ignore vendor specific usage pages
+                    if (usagePage < 0xFF00 && global.hasReportSize && global.hasReportCount)
+                        addField(type, bitOffset, global.reportSize, global.reportCount, usagePage, usageMin, usageMax, attributes);
+                }
             }
 
-            if (global.reportSize.has_value() && global.reportCount.has_value())
-                reportInfo->addBits(global.reportID.value_or(0), global.reportSize.value() * global.reportCount.value());
+            if (reportSize && global.hasReportSize && global.hasReportCount)
+                reportSize->size += global.reportSize * global.reportCount;
         }
 
         // Clear local items
@@ -377,13 +369,22 @@ public:
             case GlobalItemTag::PhysicalMaximum: global.physicalMax = value; break;
             case GlobalItemTag::UnitExponent: global.unitExponent = value; break;
             case GlobalItemTag::Unit: global.unit = value; break;
-            case GlobalItemTag::ReportSize: global.reportSize = value; break;
+            case GlobalItemTag::ReportSize:
+                global.reportSize    = value;
+                global.hasReportSize = true;
+                break;
             case GlobalItemTag::ReportID: global.reportID = value; break;
-            case GlobalItemTag::ReportCount: global.reportCount = value; break;
-            case GlobalItemTag::Push: globalStack.push_back(global); break;
+            case GlobalItemTag::ReportCount:
+                global.reportCount    = value;
+                global.hasReportCount = true;
+                break;
+            case GlobalItemTag::Push:
+                if (globalStackDepth < maxGlobalStack)
+                    globalStack[globalStackDepth++] = global;
+                break;
             case GlobalItemTag::Pop:
-                global = globalStack.back();
-                globalStack.pop_back();
+                if (globalStackDepth > 0)
+                    global = globalStack[--globalStackDepth];
                 break;
             default: break;
         }
@@ -393,33 +394,36 @@ public:
         switch (tag) {
             case LocalItemTag::Usage: local.addUsage(value, value); break;
             case LocalItemTag::UsageMinimum:
-                local.usageMinimum = value;
-                if (local.usageMaximum.has_value())
-                    local.addUsage(local.usageMinimum.value(), local.usageMaximum.value());
+                local.usageMinimum    = value;
+                local.hasUsageMinimum = true;
+                if (local.hasUsageMaximum)
+                    local.addUsage(local.usageMinimum, local.usageMaximum);
                 break;
             case LocalItemTag::UsageMaximum:
-                local.usageMaximum = value;
-                if (local.usageMinimum.has_value())
-                    local.addUsage(local.usageMinimum.value(), local.usageMaximum.value());
+                local.usageMaximum    = value;
+                local.hasUsageMaximum = true;
+                if (local.hasUsageMinimum)
+                    local.addUsage(local.usageMinimum, local.usageMaximum);
                 break;
-            case LocalItemTag::DesignatorIndex: local.designatorIndex = value; break;
-            case LocalItemTag::DesignatorMinimum: local.designatorMinimum = value; break;
-            case LocalItemTag::DesignatorMaximum: local.designatorMaximum = value; break;
-            case LocalItemTag::StringIndex: local.stringIndex = value; break;
-            case LocalItemTag::StringMinimum: local.stringMinimum = value; break;
-            case LocalItemTag::StringMaximum: local.stringMaximum = value; break;
-            case LocalItemTag::Delimiter: break;
             default: break;
         }
     }
 
-    std::vector<std::shared_ptr<HIDCollection>> parseReportDescriptor(const void *descriptor, size_t descriptorLength) {
+    bool parse(const void *descriptor, size_t descriptorLength) {
         const uint8_t *data = (const uint8_t *)descriptor;
         size_t         len  = 0;
 
+        // Rough upper bound on the number of items, avoids regrowing the vectors
+        desc.collections.clear();
+        desc.fields.clear();
+        desc.collections.reserve(descriptorLength / 16 + 1);
+        desc.fields.reserve(descriptorLength / 4 + 1);
+
         while (len < descriptorLength) {
             if (data[0] == 0xFE) {
                 // Skip long item (not specified in HID specification)
+                if (len + 3 > descriptorLength)
+                    break;
                 int size = data[1];
                 data += 3 + size;
                 len += 3 + size;
@@ -458,11 +462,17 @@ public:
             }
         }
 
-        return collections;
+        // Close collections left open by a truncated descriptor
+        while (curCollection != HIDCollection::noParent) {
+            auto &collection    = desc.collections[curCollection];
+            collection.fieldEnd = desc.fields.size();
+            curCollection       = collection.parent;
+        }
+        return !desc.collections.empty();
     }
 };
 
-std::vector<std::shared_ptr<HIDCollection>> parseReportDescriptor(const void *descriptor, size_t descriptorLength) {
-    HIDReportDescriptorParser parser;
-    return parser.parseReportDescriptor(descriptor, descriptorLength);
+bool parseReportDescriptor(const void *descriptor, size_t descriptorLength, HIDReportDescriptor &result) {
+    HIDReportDescriptorParser parser(result);
+    return parser.parse(descriptor, descriptorLength);
 }
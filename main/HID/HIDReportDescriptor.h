@@ -2,46 +2,16 @@
 
 #include "Common.h"
 
-struct HIDItem {
-    enum class ItemType {
-        Collection,
-        InputField,
-        OutputField,
-        FeatureField,
+struct HIDField {
+    enum class Type : uint8_t {
+        Input,
+        Output,
+        Feature,
     };
 
-    HIDItem(ItemType _itemType, uint16_t _usagePage)
-        : itemType(_itemType), usagePage(_usagePage) {
-    }
-
-    ItemType                              itemType;
-    uint16_t                              usagePage;
-    std::vector<std::shared_ptr<HIDItem>> subItems;
-
-    void dump(bool recurseChildren = true, int depth = 0);
-};
-
-struct HIDCollection : public HIDItem {
-    enum class CollectionType {
-        Physical      = 0x00, // CP
-        Application   = 0x01, // CA
-        Logical       = 0x02, // CL
-        Report        = 0x03,
-        NamedArray    = 0x04, // NAry
-        UsageSwitch   = 0x05, // US
-        UsageModifier = 0x06  // UM
-    };
-
-    HIDCollection(CollectionType _collectionType, uint16_t _usagePage, uint16_t _usage)
-        : HIDItem(HIDItem::ItemType::Collection, _usagePage), collectionType(_collectionType), usage(_usage) {
-    }
-
-    CollectionType collectionType;
-    uint16_t       usage;
-};
-
-struct HIDField : public HIDItem {
+    Type     type;
     uint8_t  reportID;
+    uint16_t usagePage;
     int16_t  bitIdx;
     int16_t  bitSize;
     uint32_t arraySize;
@@ -59,43 +29,37 @@ struct HIDField : public HIDItem {
     uint32_t unit;
 
     uint32_t attributes;
+};
+
+struct HIDCollection {
+    enum class CollectionType : uint8_t {
+        Physical      = 0x00, // CP
+        Application   = 0x01, // CA
+        Logical       = 0x02, // CL
+        Report        = 0x03,
+        NamedArray    = 0x04, // NAry
+        UsageSwitch   = 0x05, // US
+        UsageModifier = 0x06  // UM
+    };
+
+    static const uint16_t noParent = 0xFFFF;
+
+    CollectionType collectionType;
+    uint16_t       usagePage;
+    uint16_t       usage;
+    uint16_t       parent; // Index of parent collection or noParent for top-level
+
+    // Fields of this collection and its nested collections: fields[fieldBegin..fieldEnd)
+    uint32_t fieldBegin;
+    uint32_t fieldEnd;
+};
 
-    HIDField(
-        ItemType _itemType,
-        uint8_t  _reportID,
-        int16_t  _bitIdx,
-        uint16_t _bitSize,
-        uint16_t _arraySize,
-        uint16_t _usagePage,
-        uint16_t _usageMin,
-        uint16_t _usageMax,
-        int32_t  _logicalMin,
-        int32_t  _logicalMax,
-        int32_t  _physicalMin,
-        int32_t  _physicalMax,
-        int32_t  _unitExponent,
-        uint32_t _unit,
-        uint32_t _attributes)
-        : HIDItem(_itemType, _usagePage),
-          reportID(_reportID),
-          bitIdx(_bitIdx),
-          bitSize(_bitSize),
-          arraySize(_arraySize),
-          usageMin(_usageMin),
-          usageMax(_usageMax),
-          logicalMin(_logicalMin),
-          logicalMax(_logicalMax),
-          physicalMin(_physicalMin),
-          physicalMax(_physicalMax),
-          unitExponent(_unitExponent),
-          unit(_unit),
-          attributes(_attributes) {
+// Parsed report descriptor, collections and fields are stored in descriptor order
+struct HIDReportDescriptor {
+    std::vector<HIDCollection> collections;
+    std::vector<HIDField>      fields;
 
-        if (physicalMin == 0 && physicalMax == 0) {
-            physicalMin = logicalMin;
-            physicalMax = logicalMax;
-        }
-    }
+    void dump() const;
 };
 
-std::vector<std::shared_ptr<HIDCollection>> parseReportDescriptor(const void *descriptor, size_t descriptorLength);
+bool parseReportDescriptor(const void *descriptor, size_t descriptorLength, HIDReportDescriptor &result);
@@ -2,6 +2,7 @@
 #include "HIDReportHandlerKeyboard.h"
 #include "HIDReportHandlerMouse.h"
 #include "HIDReportHandlerGamepad.h"
+#include <algorithm>
 
 static const char *TAG = "HIDReportHandler";
 
@@ -15,33 +16,31 @@ HIDReportHandler::~HIDReportHandler() {
     }
 }
 
-bool HIDReportHandler::init(const HIDCollection *collection) {
-    enumerateCollection(collection);
-    return true;
-}
-
-void HIDReportHandler::enumerateCollection(const HIDCollection *collection) {
-    for (auto subItem : collection->subItems) {
-        if (subItem->itemType == HIDItem::ItemType::Collection) {
-            enumerateCollection(static_cast<const HIDCollection *>(subItem.get()));
-
-        } else {
-            const HIDField *field = static_cast<const HIDField *>(subItem.get());
-
-            switch (field->itemType) {
-                case HIDItem::ItemType::InputField: addInputField(*field); break;
-                case HIDItem::ItemType::OutputField: addOutputField(*field); break;
-                case HIDItem::ItemType::FeatureField: break;
-                default: break;
-            }
+bool HIDReportHandler::init(const HIDReportDescriptor &desc, const HIDCollection &collection) {
+    for (uint32_t i = collection.fieldBegin; i < collection.fieldEnd; i++) {
+        auto &field = desc.fields[i];
+        switch (field.type) {
+            case HIDField::Type::Input: addInputField(field); break;
+            case HIDField::Type::Output: addOutputField(field); break;
+            case HIDField::Type::Feature: break;
+            default: break;
         }
     }
+    _compile();
+    return true;
 }
 
 void HIDReportHandler::addInputField(const HIDField &field) {
     if (field.reportID > 0)
         hasReportId = true;
 
+    // Dedup state per report ID, so the input path doesn't allocate
+    if (std::none_of(lastReports.begin(), lastReports.end(), [&](const LastReport &r) { return r.reportId == field.reportID; })) {
+        auto &last    = lastReports.emplace_back();
+        last.reportId = field.reportID;
+        last.valid    = false;
+    }
+
     _addInputField(field);
 }
 
@@ -59,9 +58,46 @@ void HIDReportHandler::inputReport(const uint8_t *buf, size_t length) {
         buf++;
         length--;
     }
+    inputReport(reportId, buf, length);
+}
+
+void HIDReportHandler::inputReport(uint8_t reportId, const uint8_t *buf, size_t length) {
+    _beforeInputReport();
+    if (dedupReports && isDuplicateReport(reportId, buf, length))
+        return;
+
     _inputReport(reportId, buf, length);
 }
 
+bool HIDReportHandler::isDuplicateReport(uint8_t reportId, const uint8_t *buf, size_t length) {
+    if (length > maxDedupLength)
+        return false;
+
+    LastReport *last = nullptr;
+    for (auto &report : lastReports) {
+        if (report.reportId == reportId) {
+            last = &report;
+            break;
+        }
+    }
+    if (!last) {
+        // Report ID without input fields
+        return false;
+    }
+    if (last->valid && last->length == length && memcmp(last->data, buf, length) == 0)
+        return true;
+
+    last->valid  = true;
+    last->length = length;
+    memcpy(last->data, buf, length);
+    return false;
+}
+
+void HIDReportHandler::resetDedup() {
+    for (auto &report : lastReports)
+        report.valid = false;
+}
+
 void HIDReportHandler::_addInputField(const HIDField &field) {
     printf("Unhandled input field:");
     printf(
@@ -86,72 +122,72 @@ void HIDReportHandler::_addOutputField(const HIDField &field) {
 #endif
 }
 
-int32_t HIDReportHandler::readBits(const void *buf, size_t bufLen, uint32_t bitOffset, uint32_t bitLength, bool signExtend) {
-    if (bitLength > 32) {
-        return 0;
+void HIDBitField::set(uint32_t bitIdx, uint32_t _bitSize, bool _signExtend) {
+    if (_bitSize == 0 || _bitSize > 32) {
+        numBytes = 0;
+        return;
     }
+    byteOffset = bitIdx / 8;
+    shift      = bitIdx % 8;
+    bitSize    = _bitSize;
+    numBytes   = (shift + bitSize + 7) / 8;
+    signExtend = _signExtend;
+    mask       = (bitSize == 32) ? 0xFFFFFFFF : ((1U << bitSize) - 1);
+}
 
-    uint32_t result = 0;
-
-    const uint8_t *p         = (const uint8_t *)buf;
-    int            bitlen    = bitLength;
-    uint32_t       inOffset  = bitOffset;
-    uint32_t       outOffset = 0;
-
-    while (bitlen > 0) {
-        uint32_t byteIdx = (inOffset / 8);
-        if (byteIdx >= bufLen) {
-            return 0;
-        }
-
-        uint32_t bit = inOffset & 7;
-        uint32_t val = p[byteIdx] >> bit;
-
-        int bitsDone = 8 - bit;
-        if (bitsDone > bitlen) {
-            bitsDone = bitlen;
-        }
-
-        // Mask value if necessary
-        if (bitlen == bitsDone) {
-            val &= (1 << bitlen) - 1;
-        }
-
-        bitlen -= bitsDone;
-
-        // Put value in result
-        result |= val << outOffset;
+void HIDButtonMap::add(uint32_t bitIdx, unsigned outBit) {
+    bits.emplace_back(bitIdx, outBit);
+}
 
-        inOffset += bitsDone;
-        outOffset += bitsDone;
+void HIDButtonMap::compile() {
+    std::sort(bits.begin(), bits.end());
+
+    runs.clear();
+    size_t i = 0;
+    while (i < bits.size()) {
+        uint32_t bitIdx = bits[i].first;
+        uint8_t  outBit = bits[i].second;
+
+        // Runs are kept within a byte, so a short report gives the same result as reading bit by bit
+        unsigned len = 1;
+        while (i + len < bits.size() &&
+               bits[i + len].first == bitIdx + len &&
+               bits[i + len].second == outBit + len &&
+               (bitIdx + len) / 8 == bitIdx / 8)
+            len++;
+
+        auto &run    = runs.emplace_back();
+        run.outShift = outBit;
+        run.field.set(bitIdx, len);
+        i += len;
     }
+}
 
-    if (signExtend) {
-        if (result & (1 << (bitLength - 1))) {
-            result |= ~((1 << bitLength) - 1);
-        }
-    }
+uint32_t HIDButtonMap::read(const uint8_t *buf, size_t length) const {
+    uint32_t result = 0;
+    for (auto &run : runs)
+        result |= (uint32_t)run.field.read(buf, length) << run.outShift;
     return result;
-};
+}
 
-HIDReportHandler *HIDReportHandler::getReportHandlersForDescriptor(const void *reportDescBuf, size_t reportDescLen) {
+HIDReportHandler *HIDReportHandler::getReportHandlersForDescriptor(const void *reportDescBuf, size_t reportDescLen, bool replay) {
     // ESP_LOG_BUFFER_HEX(TAG, reportDescBuf, reportDescLen);
 
-    auto collections = parseReportDescriptor(reportDescBuf, reportDescLen);
+    HIDReportDescriptor desc;
+    parseReportDescriptor(reportDescBuf, reportDescLen, desc);
+    // desc.dump();
 
     HIDReportHandler *reportHandlers = nullptr;
 
-    for (auto collection : collections) {
-        if (collection->collectionType != HIDCollection::CollectionType::Application)
+    for (auto &collection : desc.collections) {
+        if (collection.parent != HIDCollection::noParent || collection.collectionType != HIDCollection::CollectionType::Application)
             continue;
 
-        ESP_LOGI(TAG, "- Application collection %04X:%04X", collection->usagePage, collection->usage);
-
-        // collection->dump(false);
+        ESP_LOGI(TAG, "- Application collection %04X:%04X", collection.usagePage, collection.usage);
 
         HIDReportHandler *reportHandler = NULL;
 
-        uint32_t usage = ((uint32_t)collection->usagePage << 16) | collection->usage;
+        uint32_t usage = ((uint32_t)collection.usagePage << 16) | collection.usage;
         switch (usage) {
             case 0x10002:
                 ESP_LOGI(TAG, "  -> Mouse detected");
@@ -160,7 +196,7 @@ HIDReportHandler *HIDReportHandler::getReportHandlersForDescriptor(const void *r
 
             case 0x10005:
                 ESP_LOGI(TAG, "  -> Gamepad detected");
-                reportHandler = new HIDReportHandlerGamepad();
+                reportHandler = new HIDReportHandlerGamepad(replay);
                 break;
 
             case 0x10006:
@@ -173,7 +209,7 @@ HIDReportHandler *HIDReportHandler::getReportHandlersForDescriptor(const void *r
         }
 
         if (reportHandler) {
-            if (!reportHandler->init(collection.get())) {
+            if (!reportHandler->init(desc, collection)) {
                 ESP_LOGE(TAG, "Could not init report handler.");
                 delete reportHandler;
                 reportHandler = NULL;
@@ -3,6 +3,55 @@
 #include "Common.h"
 #include "HIDReportDescriptor.h"
 
+// Field location compiled into a byte offset, shift and mask, so the field can
+// be extracted with a single unaligned word load instead of bit by bit.
+struct HIDBitField {
+    uint16_t byteOffset = 0;
+    uint8_t  numBytes   = 0; // 0 when field not present
+    uint8_t  shift      = 0;
+    uint8_t  bitSize    = 0;
+    bool     signExtend = false;
+    uint32_t mask       = 0;
+
+    void set(uint32_t bitIdx, uint32_t bitSize, bool signExtend = false);
+    bool isValid() const { return numBytes != 0; }
+
+    // Returns 0 when the field lies (partially) outside of the report
+    int32_t read(const uint8_t *buf, size_t length) const {
+        if (byteOffset + numBytes > length)
+            return 0;
+
+        uint64_t val = 0;
+        if (byteOffset + sizeof(val) <= length)
+            memcpy(&val, buf + byteOffset, sizeof(val));
+        else
+            memcpy(&val, buf + byteOffset, numBytes);
+
+        uint32_t result = (uint32_t)(val >> shift) & mask;
+        if (signExtend && (result >> (bitSize - 1)) & 1)
+            result |= ~mask;
+        return (int32_t)result;
+    }
+};
+
+// Set of 1-bit fields mapped onto bits of an output word. Runs of consecutive
+// input bits mapping to consecutive output bits are extracted in one go.
+class HIDButtonMap {
+public:
+    void     add(uint32_t bitIdx, unsigned outBit);
+    void     compile();
+    uint32_t read(const uint8_t *buf, size_t length) const;
+    bool     isEmpty() const { return bits.empty(); }
+
+private:
+    struct Run {
+        HIDBitField field;
+        uint8_t     outShift;
+    };
+    std::vector<std::pair<uint32_t, uint8_t>> bits;
+    std::vector<Run>                          runs;
+};
+
 class HIDReportHandler {
 public:
     enum Type {
@@ -12,27 +61,49 @@ public:
         TGamepad,
     };
 
-    static HIDReportHandler *getReportHandlersForDescriptor(const void *reportDescBuf, size_t reportDescLen);
+    // Handlers for replay (InputRecorder) don't take gamepad slots from connected devices
+    static HIDReportHandler *getReportHandlersForDescriptor(const void *reportDescBuf, size_t reportDescLen, bool replay = false);
 
     HIDReportHandler(Type type);
     virtual ~HIDReportHandler();
 
-    virtual bool init(const HIDCollection *collection);
+    // Adds the fields of the collection (including nested collections)
+    virtual bool init(const HIDReportDescriptor &desc, const HIDCollection &collection);
 
     void addInputField(const HIDField &field);
     void addOutputField(const HIDField &field);
     void inputReport(const uint8_t *buf, size_t length);
 
+    // Report without report ID prefix, ID is known by the transport (BLE report reference)
+    void inputReport(uint8_t reportId, const uint8_t *buf, size_t length);
+
     HIDReportHandler *next        = nullptr;
     Type              type        = TUndefined;
     bool              hasReportId = false;
 
 protected:
+    // Skip reports identical to the previous one with the same report ID.
+    // Should be disabled for handlers reporting relative values.
+    bool dedupReports = true;
+
     virtual void _addInputField(const HIDField &field);
     virtual void _addOutputField(const HIDField &field);
+    virtual void _compile() {}           // Called after all fields are added
+    virtual void _beforeInputReport() {} // Called for every report, also for duplicates
     virtual void _inputReport(uint8_t reportId, const uint8_t *buf, size_t length) = 0;
 
-    void enumerateCollection(const HIDCollection *collection);
+    void resetDedup(); // Next report is passed on even if unchanged
+
+private:
+    bool isDuplicateReport(uint8_t reportId, const uint8_t *buf, size_t length);
 
-    int32_t readBits(const void *buf, size_t bufLen, uint32_t bitOffset, uint32_t bitLength, bool signExtend);
+    static const size_t maxDedupLength = 64;
+
+    struct LastReport {
+        uint8_t reportId;
+        bool    valid;
+        uint8_t length;
+        uint8_t data[maxDedupLength];
+    };
+    std::vector<LastReport> lastReports; // One entry per input report ID, allocated in init()
 };
@@ -1,29 +1,45 @@
 #include "HIDReportHandlerGamepad.h"
-#include <math.h>
 #include "FpgaCore.h"
 #include "GameCtrl.h"
+#include "GamepadSlots.h"
+#include "LatencyTrace.h"
+#include "InputRecorder.h"
+#include <nvs_flash.h>
 
 static const char *TAG = "HIDReportHandlerGamepad";
 
-IdxAlloc HIDReportHandlerGamepad::idxAlloc;
+IdxAlloc              HIDReportHandlerGamepad::replayPlayers(NUM_PLAYERS);
+std::atomic<unsigned> HIDReportHandlerGamepad::deadZoneGeneration(1);
 
 // #define PRINT_INPUT
 
-HIDReportHandlerGamepad::HIDReportHandlerGamepad()
-    : HIDReportHandler(TGamepad) {
+HIDReportHandlerGamepad::HIDReportHandlerGamepad(bool _replay)
+    : HIDReportHandler(TGamepad), replay(_replay) {
 
-    for (int i = 0; i < 16; i++) {
-        idxBtns[i] = -1;
-    }
     memset(&lastData, 0, sizeof(lastData));
 
-    gamePadIdx = idxAlloc.alloc();
-    ESP_LOGI(TAG, "Allocated game pad idx %d", gamePadIdx);
+    if (replay) {
+        player = replayPlayers.alloc();
+    } else {
+        handle = GamepadSlots::instance()->add();
+        if (handle < 0)
+            ESP_LOGW(TAG, "Too many gamepads connected, ignoring gamepad");
+    }
 }
 
 HIDReportHandlerGamepad::~HIDReportHandlerGamepad() {
-    ESP_LOGI(TAG, "Freeing game pad idx %d", gamePadIdx);
-    idxAlloc.free(gamePadIdx);
+    if (replay) {
+        // Release buttons held by the replay
+        auto core = FpgaCore::get();
+        if (core && player >= 0) {
+            GamePadData data;
+            memset(&data, 0, sizeof(data));
+            core->gamepadReport(player, data);
+        }
+        replayPlayers.free(player);
+    } else {
+        GamepadSlots::instance()->remove(handle);
+    }
 }
 
 void HIDReportHandlerGamepad::_addInputField(const HIDField &field) {
@@ -34,34 +50,19 @@ void HIDReportHandlerGamepad::_addInputField(const HIDField &field) {
             case 1: {
                 switch (field.usageMin) {
                     case 0x30: // X (left stick X)
-                        idxLSX  = field.bitIdx;
-                        sizeLSX = field.bitSize;
-                        minLSX  = field.logicalMin;
-                        maxLSX  = field.logicalMax;
+                        axisLSX.set(field);
                         break;
                     case 0x31: // Y (left stick Y)
-                        idxLSY  = field.bitIdx;
-                        sizeLSY = field.bitSize;
-                        minLSY  = field.logicalMin;
-                        maxLSY  = field.logicalMax;
+                        axisLSY.set(field);
                         break;
                     case 0x32: // Z
-                        idxRSX  = field.bitIdx;
-                        sizeRSX = field.bitSize;
-                        minRSX  = field.logicalMin;
-                        maxRSX  = field.logicalMax;
+                        axisRSX.set(field);
                         break;
                     case 0x35: // Rz
-                        idxRSY  = field.bitIdx;
-                        sizeRSY = field.bitSize;
-                        minRSY  = field.logicalMin;
-                        maxRSY  = field.logicalMax;
+                        axisRSY.set(field);
                         break;
                     case 0x39: // Hat switch (D-pad)
-                        idxHat  = field.bitIdx;
-                        sizeHat = field.bitSize;
-                        minHat  = field.logicalMin;
-                        maxHat  = field.logicalMax;
+                        axisHat.set(field);
                         break;
                     default: break;
                 }
@@ -71,16 +72,10 @@ void HIDReportHandlerGamepad::_addInputField(const HIDField &field) {
             case 2: {
                 switch (field.usageMin) {
                     case 0xC4: // Accelerator
-                        idxRT  = field.bitIdx;
-                        sizeRT = field.bitSize;
-                        minRT  = field.logicalMin;
-                        maxRT  = field.logicalMax;
+                        axisRT.set(field);
                         break;
                     case 0xC5: // Brake
-                        idxLT  = field.bitIdx;
-                        sizeLT = field.bitSize;
-                        minLT  = field.logicalMin;
-                        maxLT  = field.logicalMax;
+                        axisLT.set(field);
                         break;
                 }
                 break;
@@ -89,17 +84,17 @@ void HIDReportHandlerGamepad::_addInputField(const HIDField &field) {
             case 9: {
                 if (field.bitSize == 1) {
                     switch (field.usageMin) {
-                        case 1: idxBtns[GCB_A_IDX] = field.bitIdx; break;
-                        case 2: idxBtns[GCB_B_IDX] = field.bitIdx; break;
-                        case 4: idxBtns[GCB_X_IDX] = field.bitIdx; break;
-                        case 5: idxBtns[GCB_Y_IDX] = field.bitIdx; break;
-                        case 7: idxBtns[GCB_LB_IDX] = field.bitIdx; break;
-                        case 8: idxBtns[GCB_RB_IDX] = field.bitIdx; break;
-                        case 11: idxBtns[GCB_VIEW_IDX] = field.bitIdx; break;
-                        case 12: idxBtns[GCB_MENU_IDX] = field.bitIdx; break;
-                        case 13: idxBtns[GCB_GUIDE_IDX] = field.bitIdx; break;
-                        case 14: idxBtns[GCB_LS_IDX] = field.bitIdx; break;
-                        case 15: idxBtns[GCB_RS_IDX] = field.bitIdx; break;
+                        case 1: buttonMap.add(field.bitIdx, GCB_A_IDX); break;
+                        case 2: buttonMap.add(field.bitIdx, GCB_B_IDX); break;
+                        case 4: buttonMap.add(field.bitIdx, GCB_X_IDX); break;
+                        case 5: buttonMap.add(field.bitIdx, GCB_Y_IDX); break;
+                        case 7: buttonMap.add(field.bitIdx, GCB_LB_IDX); break;
+                        case 8: buttonMap.add(field.bitIdx, GCB_RB_IDX); break;
+                        case 11: buttonMap.add(field.bitIdx, GCB_VIEW_IDX); break;
+                        case 12: buttonMap.add(field.bitIdx, GCB_MENU_IDX); break;
+                        case 13: buttonMap.add(field.bitIdx, GCB_GUIDE_IDX); break;
+                        case 14: buttonMap.add(field.bitIdx, GCB_LS_IDX); break;
+                        case 15: buttonMap.add(field.bitIdx, GCB_RS_IDX); break;
                         default: break;
                     }
                 }
@@ -108,7 +103,7 @@ void HIDReportHandlerGamepad::_addInputField(const HIDField &field) {
 
             case 0x0C: {
                 if (field.usageMin == 0xB2) { // Phone key 2
-                    idxBtns[GCB_SHARE_IDX] = field.bitIdx;
+                    buttonMap.add(field.bitIdx, GCB_SHARE_IDX);
                 }
                 break;
             }
@@ -117,65 +112,164 @@ void HIDReportHandlerGamepad::_addInputField(const HIDField &field) {
     }
 }
 
-static inline float remap(float val, float in_min, float in_max, float out_min, float out_max, bool clip = true) {
-    float result = ((val - in_min) / (in_max - in_min)) * (out_max - out_min) + out_min;
-    if (clip)
-        result = std::max(out_min, std::min(result, out_max));
-    return result;
+// Loaded from NVS on first use, static initialization is thread-safe
+HIDReportHandlerGamepad::DeadZones::DeadZones() {
+    memset(pct, defaultDeadZone, sizeof(pct));
+
+    nvs_handle_t h;
+    if (nvs_open("settings", NVS_READONLY, &h) == ESP_OK) {
+        uint8_t buf[sizeof(pct)];
+        size_t  sz = sizeof(buf);
+        if (nvs_get_blob(h, "gpDeadZone", buf, &sz) == ESP_OK && sz == sizeof(buf)) {
+            memcpy(pct, buf, sizeof(pct));
+        }
+        nvs_close(h);
+    }
 }
 
-int8_t HIDReportHandlerGamepad::getInt8(int idx, int size, int minVal, int maxVal, const uint8_t *buf, size_t length) {
-    if (idx < 0)
-        return 0;
+HIDReportHandlerGamepad::DeadZones &HIDReportHandlerGamepad::deadZones() {
+    static DeadZones obj;
+    return obj;
+}
+
+int HIDReportHandlerGamepad::getDeadZone(unsigned idx) {
+    return idx < NUM_PLAYERS ? deadZones().pct[idx] : defaultDeadZone;
+}
 
-    float val = remap(readBits(buf, length, idx, size, false), minVal, maxVal, -1, 1, false);
+void HIDReportHandlerGamepad::setDeadZone(unsigned idx, int pct) {
+    if (idx >= NUM_PLAYERS)
+        return;
+
+    auto &dz = deadZones();
+    pct      = std::max(0, std::min(pct, 50));
+    if (dz.pct[idx] == pct)
+        return;
+    dz.pct[idx] = pct;
 
-    // Apply dead zone
-    const float deadZone = 0.1f;
-    if (val <= -deadZone) {
-        return (int8_t)remap(val, -1, -deadZone, -127, 0);
-    } else if (val >= deadZone) {
-        return (int8_t)remap(val, deadZone, 1, 0, 127);
+    nvs_handle_t h;
+    if (nvs_open("settings", NVS_READWRITE, &h) == ESP_OK) {
+        if (nvs_set_blob(h, "gpDeadZone", dz.pct, sizeof(dz.pct)) == ESP_OK) {
+            nvs_commit(h);
+        }
+        nvs_close(h);
     }
-    return 0;
+
+    // Handlers recompile their axes on the next report
+    deadZoneGeneration++;
 }
 
-uint8_t HIDReportHandlerGamepad::getUInt8(int idx, int size, int minVal, int maxVal, const uint8_t *buf, size_t length) {
-    if (idx < 0)
+void HIDReportHandlerGamepad::Axis::compile(bool _isSigned, int deadZonePct) {
+    lut.clear();
+    scale    = 0;
+    isSigned = _isSigned;
+    if (!field.isValid() || max <= min)
+        return;
+
+    // Raw values are doubled to keep the center of signed axes exact
+    int64_t range2;
+    if (isSigned) {
+        origin2 = (int64_t)min + max;
+        range2  = (int64_t)max - min;
+        outMax  = 127;
+    } else {
+        origin2 = 2 * (int64_t)min;
+        range2  = 2 * ((int64_t)max - min);
+        outMax  = 255;
+    }
+    deadZone2 = range2 * deadZonePct / 100;
+    span2     = range2 - deadZone2;
+    scale     = (((int64_t)outMax << 32) + span2 - 1) / span2;
+
+    if (field.bitSize <= 8) {
+        lut.resize(1 << field.bitSize);
+        for (unsigned i = 0; i < lut.size(); i++) {
+            int32_t raw = i;
+            if (field.signExtend && (i >> (field.bitSize - 1)) & 1)
+                raw |= ~field.mask;
+            lut[i] = (uint8_t)map(raw);
+        }
+    }
+}
+
+int HIDReportHandlerGamepad::Axis::map(int32_t raw) const {
+    if (scale == 0)
+        return 0;
+
+    int64_t val = 2 * (int64_t)raw - origin2;
+    if (val < 0 && !isSigned)
+        return 0;
+    int64_t mag = (val < 0 ? -val : val) - deadZone2;
+    if (mag <= 0)
         return 0;
 
-    float val = remap(readBits(buf, length, idx, size, false), minVal, maxVal, 0, 1, false);
+    int result = (mag >= span2) ? outMax : (int)((mag * scale) >> 32);
+    return val < 0 ? -result : result;
+}
+
+int HIDReportHandlerGamepad::Axis::read(const uint8_t *buf, size_t length) const {
+    if (!lut.empty())
+        return lut[field.read(buf, length) & field.mask];
+    return map(field.read(buf, length));
+}
+
+void HIDReportHandlerGamepad::compileAxes() {
+    compiledGeneration = deadZoneGeneration;
+
+    int deadZone = getDeadZone(player);
+    axisLSX.compile(true, deadZone);
+    axisLSY.compile(true, deadZone);
+    axisRSX.compile(true, deadZone);
+    axisRSY.compile(true, deadZone);
+    axisLT.compile(false, deadZone / 2);
+    axisRT.compile(false, deadZone / 2);
+}
 
-    // Apply dead zone
-    const float deadZone = 0.05f;
-    if (val >= deadZone) {
-        return (int8_t)remap(val, deadZone, 1, 0, 255);
+void HIDReportHandlerGamepad::_compile() {
+    buttonMap.compile();
+    compileAxes();
+}
+
+// Runs before duplicate reports are dropped, so a waiting gamepad is promoted
+// and reports its state even if it keeps sending the same report
+void HIDReportHandlerGamepad::_beforeInputReport() {
+    if (replay || handle < 0)
+        return;
+
+    auto slots     = GamepadSlots::instance();
+    int  newPlayer = slots->getPlayer(handle);
+    if (newPlayer < 0) {
+        // Waiting for a player slot
+        slots->promote();
+        newPlayer = slots->getPlayer(handle);
+    }
+    if (newPlayer != player) {
+        // (Re)assigned: the core slot starts out released, dead zone is per player
+        player             = newPlayer;
+        compiledGeneration = 0;
+        memset(&lastData, 0, sizeof(lastData));
+        resetDedup();
     }
-    return 0;
 }
 
 void HIDReportHandlerGamepad::_inputReport(uint8_t reportId, const uint8_t *buf, size_t length) {
+    if (player < 0)
+        return;
+
+    if (compiledGeneration != deadZoneGeneration)
+        compileAxes();
+
     GamePadData data;
-    data.lx      = getInt8(idxLSX, sizeLSX, minLSX, maxLSX, buf, length);
-    data.ly      = getInt8(idxLSY, sizeLSY, minLSY, maxLSY, buf, length);
-    data.rx      = getInt8(idxRSX, sizeRSX, minRSX, maxRSX, buf, length);
-    data.ry      = getInt8(idxRSY, sizeRSY, minRSY, maxRSY, buf, length);
-    data.lt      = getUInt8(idxLT, sizeLT, minLT, maxLT, buf, length);
-    data.rt      = getUInt8(idxRT, sizeRT, minRT, maxRT, buf, length);
-    data.buttons = 0;
-
-    for (int i = 0; i < 16; i++) {
-        // printf("%d:%d ", idxBtns[i]);
-
-        if (idxBtns[i] >= 0 && readBits(buf, length, idxBtns[i], 1, 0)) {
-            data.buttons |= (1 << i);
-        }
-    }
-    // printf("\n");
+    data.lx      = (int8_t)axisLSX.read(buf, length);
+    data.ly      = (int8_t)axisLSY.read(buf, length);
+    data.rx      = (int8_t)axisRSX.read(buf, length);
+    data.ry      = (int8_t)axisRSY.read(buf, length);
+    data.lt      = (uint8_t)axisLT.read(buf, length);
+    data.rt      = (uint8_t)axisRT.read(buf, length);
+    data.buttons = buttonMap.read(buf, length);
 
-    if (idxHat >= 0) {
-        int hat = readBits(buf, length, idxHat, sizeHat, false);
-        switch (hat - minHat) {
+    if (axisHat.field.isValid()) {
+        int hat = axisHat.field.read(buf, length);
+        switch (hat - axisHat.min) {
             case 0: data.buttons |= GCB_DPAD_UP; break;                    // UP
             case 1: data.buttons |= GCB_DPAD_UP | GCB_DPAD_RIGHT; break;   // UP+RIGHT
             case 2: data.buttons |= GCB_DPAD_RIGHT; break;                 // RIGHT
@@ -241,7 +335,9 @@ void HIDReportHandlerGamepad::_inputReport(uint8_t reportId, const uint8_t *buf,
 #endif
 
     auto core = FpgaCore::get();
-    if (core && gamePadIdx >= 0) {
-        core->gamepadReport(gamePadIdx, data);
+    if (core) {
+        LatencyTrace::instance()->mark(TracePoint::Core);
+        InputRecorder::instance()->event(InputEvent::Gamepad, player, data.buttons);
+        core->gamepadReport(player, data);
     }
 }
@@ -1,34 +1,70 @@
 #pragma once
 
 #include "HIDReportHandler.h"
-#include "IdxAlloc.h"
 #include "FpgaCore.h"
+#include "GamepadSlots.h"
+#include "IdxAlloc.h"
+#include <atomic>
 
 class HIDReportHandlerGamepad : public HIDReportHandler {
 public:
-    HIDReportHandlerGamepad();
+    HIDReportHandlerGamepad(bool replay = false);
     virtual ~HIDReportHandlerGamepad();
 
+    // Stick dead zone in percent per player (stored in NVS), triggers use half of it
+    static int  getDeadZone(unsigned idx);
+    static void setDeadZone(unsigned idx, int pct);
+
 private:
     void _addInputField(const HIDField &field) override;
+    void _compile() override;
+    void _beforeInputReport() override;
     void _inputReport(uint8_t reportId, const uint8_t *buf, size_t length) override;
 
-    int idxLSX = -1, sizeLSX = -1, minLSX, maxLSX;
-    int idxLSY = -1, sizeLSY = -1, minLSY, maxLSY;
-    int idxRSX = -1, sizeRSX = -1, minRSX, maxRSX;
-    int idxRSY = -1, sizeRSY = -1, minRSY, maxRSY;
-    int idxLT = -1, sizeLT = -1, minLT, maxLT;
-    int idxRT = -1, sizeRT = -1, minRT, maxRT;
-    int idxHat = -1, sizeHat = -1, minHat, maxHat;
-    int idxBtns[16];
+    // Axis mapping with dead zone, precomputed as fixed-point scale factor.
+    // Fields of up to 8 bits are mapped using a lookup table instead.
+    struct Axis {
+        HIDBitField          field;
+        int                  min = 0;
+        int                  max = 0;
+        int64_t              origin2   = 0; // Output zero point (doubled raw value)
+        int64_t              deadZone2 = 0; // Dead zone (doubled raw value)
+        int64_t              span2     = 0; // Range beyond the dead zone (doubled raw value)
+        int64_t              scale     = 0; // 32.32 scale from doubled raw value to output
+        int                  outMax    = 0;
+        bool                 isSigned  = false;
+        std::vector<uint8_t> lut;
 
-    int8_t  getInt8(int idx, int size, int min, int max, const uint8_t *buf, size_t length);
-    uint8_t getUInt8(int idx, int size, int min, int max, const uint8_t *buf, size_t length);
+        void set(const HIDField &f) {
+            field.set(f.bitIdx, f.bitSize, f.logicalMin < 0);
+            min = f.logicalMin;
+            max = f.logicalMax;
+        }
+        void compile(bool isSigned, int deadZonePct);
+        int  map(int32_t raw) const;
+        int  read(const uint8_t *buf, size_t length) const;
+    };
 
-    int reportId   = 0;
-    int gamePadIdx = -1;
+    Axis         axisLSX, axisLSY, axisRSX, axisRSY, axisLT, axisRT, axisHat;
+    HIDButtonMap buttonMap;
+
+    void compileAxes();
+
+    int      reportId           = 0;
+    bool     replay             = false;
+    int      handle             = -1; // GamepadSlots handle
+    int      player             = -1; // Player slot, -1 while waiting
+    unsigned compiledGeneration = 0;
 
     GamePadData lastData;
 
-    static IdxAlloc idxAlloc;
+    static IdxAlloc replayPlayers; // Player slots of replayed gamepads, not registered in GamepadSlots
+
+    struct DeadZones {
+        uint8_t pct[NUM_PLAYERS];
+        DeadZones();
+    };
+    static DeadZones            &deadZones();
+    static const int             defaultDeadZone = 10;
+    static std::atomic<unsigned> deadZoneGeneration;
 };
@@ -1,33 +1,43 @@
 #include "HIDReportHandlerKeyboard.h"
 #include "Keyboard.h"
+#include <algorithm>
 
 static const char *TAG = "HIDReportHandlerKeyboard";
 
 HIDReportHandlerKeyboard::HIDReportHandlerKeyboard()
     : HIDReportHandler(TKeyboard) {
-
-    for (int i = 0; i < maxButtons; i++) {
-        buttons[i] = -1;
-    }
-    for (unsigned i = 0; i < maxKeyData; i++) {
-        prevKeyData[i] = 0;
-    }
 }
 
 HIDReportHandlerKeyboard::~HIDReportHandlerKeyboard() {
 }
 
+HIDReportHandlerKeyboard::ReportPlan *HIDReportHandlerKeyboard::getPlan(uint8_t reportId, bool create) {
+    for (auto &plan : plans) {
+        if (plan.reportId == reportId)
+            return &plan;
+    }
+    if (!create)
+        return nullptr;
+
+    auto &plan    = plans.emplace_back();
+    plan.reportId = reportId;
+    return &plan;
+}
+
 void HIDReportHandlerKeyboard::_addInputField(const HIDField &field) {
     if (field.usagePage == 7) {
         if (field.attributes & (1 << 1)) {
-            if (field.bitSize == 1 && field.usageMin >= 0xE0 && field.usageMin <= 0xE7) {
-                buttons[field.usageMin - 0xE0] = field.bitIdx;
+            // Variable: modifiers and NKRO key bitmap
+            if (field.bitSize == 1 && field.usageMin < 256) {
+                auto plan = getPlan(field.reportID, true);
+                plan->bitmap[field.usageMin / 32].add(field.bitIdx, field.usageMin % 32);
             }
         } else {
             if (field.arraySize <= maxKeyData) {
-                keyArrayIdx      = field.bitIdx;
-                keyArrayItemSize = field.bitSize;
-                keyArrayItems    = field.arraySize;
+                auto plan              = getPlan(field.reportID, true);
+                plan->keyArrayIdx      = field.bitIdx;
+                plan->keyArrayItemSize = field.bitSize;
+                plan->keyArrayItems    = field.arraySize;
             }
         }
     }
@@ -44,116 +54,113 @@ void HIDReportHandlerKeyboard::_addOutputField(const HIDField &field) {
     }
 }
 
-void HIDReportHandlerKeyboard::_inputReport(uint8_t reportId, const uint8_t *buf, size_t length) {
-    // ESP_LOGI(TAG, "HIDReportHandlerKeyboard::inputReport %u", reportId);
-    // ESP_LOG_BUFFER_HEX(TAG, buf, length);
-    // auto &aqkb = AqKeyboard::instance();
-
-    if (keyArrayIdx < 0) {
-        return;
-    }
+void HIDReportHandlerKeyboard::_compile() {
+    for (auto &plan : plans) {
+        for (int i = 0; i < 8; i++) {
+            if (!plan.bitmap[i].isEmpty()) {
+                plan.bitmap[i].compile();
+                plan.bitmapWords |= (1 << i);
+            }
+        }
 
-    uint8_t modifiers = 0;
-    if (buttons[LCtrl] >= 0) {
-        modifiers |= readBits(buf, length, buttons[LCtrl], 1, false) << 0;
-    }
-    if (buttons[LShift] >= 0) {
-        modifiers |= readBits(buf, length, buttons[LShift], 1, false) << 1;
-    }
-    if (buttons[LAlt] >= 0) {
-        modifiers |= readBits(buf, length, buttons[LAlt], 1, false) << 2;
-    }
-    if (buttons[LGui] >= 0) {
-        modifiers |= readBits(buf, length, buttons[LGui], 1, false) << 3;
-    }
-    if (buttons[RCtrl] >= 0) {
-        modifiers |= readBits(buf, length, buttons[RCtrl], 1, false) << 4;
-    }
-    if (buttons[RShift] >= 0) {
-        modifiers |= readBits(buf, length, buttons[RShift], 1, false) << 5;
-    }
-    if (buttons[RAlt] >= 0) {
-        modifiers |= readBits(buf, length, buttons[RAlt], 1, false) << 6;
-    }
-    if (buttons[RGui] >= 0) {
-        modifiers |= readBits(buf, length, buttons[RGui], 1, false) << 7;
+        if (plan.keyArrayIdx >= 0) {
+            plan.keyArrayBytes = (plan.keyArrayItemSize == 8 && (plan.keyArrayIdx % 8) == 0);
+            for (int i = 0; i < plan.keyArrayItems; i++)
+                plan.keyFields[i].set(plan.keyArrayIdx + i * plan.keyArrayItemSize, plan.keyArrayItemSize);
+        }
     }
+}
 
-    uint8_t releasedModifiers = ~modifiers & prevModifiers;
-    uint8_t pressedModifiers  = modifiers & ~prevModifiers;
-    prevModifiers             = modifiers;
+void HIDReportHandlerKeyboard::_inputReport(uint8_t reportId, const uint8_t *buf, size_t length) {
+    // ESP_LOGI(TAG, "HIDReportHandlerKeyboard::inputReport %u", reportId);
+    // ESP_LOG_BUFFER_HEX(TAG, buf, length);
 
-    uint8_t keyData[maxKeyData];
-    for (int i = 0; i < keyArrayItems; i++) {
-        keyData[i] = readBits(buf, length, keyArrayIdx + i * keyArrayItemSize, keyArrayItemSize, false);
+    auto plan = getPlan(reportId, false);
+    if (!plan && reportId == 0 && !plans.empty()) {
+        // Report ID unknown (Bluetooth device without report reference)
+        plan = &plans[0];
     }
-
-    // Don't process during rollover
-    if (keyData[0] == 1) {
+    if (!plan)
         return;
-    }
 
-    // Process modifier key changes
+    KeyBits cur = {};
+
+    // Bitmap fields
     for (int i = 0; i < 8; i++) {
-        if (releasedModifiers & (1 << i)) {
-            Keyboard::instance()->handleScancode(0xE0 + i, false);
-        }
-        if (pressedModifiers & (1 << i)) {
-            Keyboard::instance()->handleScancode(0xE0 + i, true);
+        if (plan->bitmapWords & (1 << i))
+            cur.words[i] = plan->bitmap[i].read(buf, length);
+    }
+
+    // Key array
+    if (plan->keyArrayItems > 0) {
+        uint8_t keyData[maxKeyData];
+        int     count = plan->keyArrayItems;
+        if (plan->keyArrayBytes) {
+            // Items missing from a short report read as 0
+            size_t offset = plan->keyArrayIdx / 8;
+            size_t avail  = (offset < length) ? std::min((size_t)count, length - offset) : 0;
+            memcpy(keyData, buf + offset, avail);
+            memset(keyData + avail, 0, count - avail);
+        } else {
+            for (int i = 0; i < count; i++) {
+                keyData[i] = plan->keyFields[i].read(buf, length);
+            }
         }
-    }
-
-    uint8_t prev, cur;
-
-    // Check for key releases
-    for (int j = 0; j < keyArrayItems; j++) {
-        if ((prev = prevKeyData[j]) == 0)
-            break;
 
-        // Check if this key is in current report
-        bool keyReleased = true;
-        for (int i = 0; i < keyArrayItems; i++) {
-            if ((cur = keyData[i]) == 0)
-                break;
-
-            if (prev == cur) {
-                keyReleased = false;
-                break;
-            }
+        // Don't process during rollover
+        if (keyData[0] == 1) {
+            return;
         }
 
-        if (keyReleased) {
-            Keyboard::instance()->handleScancode(prev, false);
+        for (int i = 0; i < count; i++) {
+            // 0: no key, 1-3: error codes
+            if (keyData[i] >= 4)
+                cur.words[keyData[i] / 32] |= 1U << (keyData[i] % 32);
         }
     }
 
-    // Check for key presses
-    for (int j = 0; j < keyArrayItems; j++) {
-        if ((cur = keyData[j]) == 0)
-            break;
-
-        // Check if this key is in previous report
-        bool keyPressed = true;
-        for (int i = 0; i < keyArrayItems; i++) {
-            if ((prev = prevKeyData[i]) == 0)
-                break;
+    // Combine state of all reports
+    plan->state = cur;
+    KeyBits newState;
+    for (int i = 0; i < 8; i++) {
+        uint32_t val = 0;
+        for (auto &p : plans)
+            val |= p.state.words[i];
+        newState.words[i] = val;
+    }
 
-            if (prev == cur) {
-                keyPressed = false;
-                break;
+    uint32_t changed[8];
+    bool     anyChanged = false;
+    for (int i = 0; i < 8; i++) {
+        changed[i] = newState.words[i] ^ keyState.words[i];
+        anyChanged |= (changed[i] != 0);
+    }
+    if (!anyChanged)
+        return;
+    keyState = newState;
+
+    // Apply all changes of this report as a single key matrix update
+    auto keyboard = Keyboard::instance();
+    keyboard->beginBatch();
+
+    // Process modifier key changes (usages E0-E7) first
+    for (uint32_t bits = changed[7] & 0xFF; bits; bits &= bits - 1) {
+        unsigned bit = __builtin_ctz(bits);
+        keyboard->handleScancode(0xE0 + bit, (newState.words[7] >> bit) & 1);
+    }
+    changed[7] &= ~0xFF;
+
+    // Key releases, followed by key presses
+    for (int pass = 0; pass < 2; pass++) {
+        bool keyDown = (pass == 1);
+        for (int i = 0; i < 8; i++) {
+            uint32_t bits = changed[i] & (keyDown ? newState.words[i] : ~newState.words[i]);
+            for (; bits; bits &= bits - 1) {
+                keyboard->handleScancode(i * 32 + __builtin_ctz(bits), keyDown);
             }
         }
-
-        if (keyPressed) {
-            Keyboard::instance()->handleScancode(cur, true);
-        }
-    }
-
-    // Copy current key data to prev key data
-    for (int i = 0; i < keyArrayItems; i++) {
-        prevKeyData[i] = keyData[i];
     }
-    // aqkb.updateMatrix();
+    keyboard->endBatch();
 }
 
 uint8_t HIDReportHandlerKeyboard::outputReport(uint8_t leds) const {
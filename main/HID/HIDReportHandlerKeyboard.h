@@ -18,33 +18,35 @@ public:
 protected:
     void _addInputField(const HIDField &field) override;
     void _addOutputField(const HIDField &field) override;
+    void _compile() override;
     void _inputReport(uint8_t reportId, const uint8_t *buf, size_t length) override;
 
-    void compareKeyArrays(
-        const uint8_t *keys1, const uint8_t *keys2,
-        uint8_t *only1, uint8_t *only2, uint8_t *both,
-        unsigned numElements);
-
-    enum {
-        LCtrl = 0,
-        LShift,
-        LAlt,
-        LGui,
-        RCtrl,
-        RShift,
-        RAlt,
-        RGui,
-        maxButtons,
+    static const unsigned maxKeyData = 16;
+
+    // Key state as bitset indexed by usage (page 7), modifiers are usages E0-E7
+    struct KeyBits {
+        uint32_t words[8];
     };
-    int buttons[maxButtons];
 
-    int keyArrayIdx      = -1;
-    int keyArrayItemSize = -1;
-    int keyArrayItems    = -1;
+    // Decoding plan for the keyboard fields of a single report ID
+    struct ReportPlan {
+        uint8_t      reportId = 0;
+        HIDButtonMap bitmap[8]; // 1-bit variable fields (modifiers and NKRO bitmap), per 32 usages
+        uint8_t      bitmapWords = 0;
 
-    static const unsigned maxKeyData = 16;
-    uint8_t               prevKeyData[maxKeyData];
-    uint8_t               prevModifiers = 0;
+        int         keyArrayIdx      = -1;
+        int         keyArrayItemSize = -1;
+        int         keyArrayItems    = 0;
+        bool        keyArrayBytes    = false; // Byte aligned 8-bit items, copied directly
+        HIDBitField keyFields[maxKeyData];
+
+        KeyBits state = {}; // Keys currently down according to this report
+    };
+
+    ReportPlan *getPlan(uint8_t reportId, bool create);
+
+    std::vector<ReportPlan> plans;
+    KeyBits                 keyState = {};
 
     int ledNumLockIdx    = -1;
     int ledCapsLockIdx   = -1;
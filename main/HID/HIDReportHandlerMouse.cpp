@@ -1,18 +1,11 @@
 #include "HIDReportHandlerMouse.h"
 #include "FpgaCore.h"
+#include "InputRecorder.h"
 
 HIDReportHandlerMouse::HIDReportHandlerMouse()
     : HIDReportHandler(TMouse) {
-
-    for (int i = 0; i < maxButtons; i++) {
-        buttons[i] = -1;
-    }
-    xIdx      = -1;
-    yIdx      = -1;
-    wheelIdx  = -1;
-    xSize     = -1;
-    ySize     = -1;
-    wheelSize = -1;
+    // Repeated reports with the same movement are real movement
+    dedupReports = false;
 }
 
 HIDReportHandlerMouse::~HIDReportHandlerMouse() {
@@ -23,18 +16,9 @@ void HIDReportHandlerMouse::_addInputField(const HIDField &field) {
         switch (field.usagePage) {
             case 1: {
                 switch (field.usageMin) {
-                    case 0x30:
-                        xIdx  = field.bitIdx;
-                        xSize = field.bitSize;
-                        break;
-                    case 0x31:
-                        yIdx  = field.bitIdx;
-                        ySize = field.bitSize;
-                        break;
-                    case 0x38:
-                        wheelIdx  = field.bitIdx;
-                        wheelSize = field.bitSize;
-                        break;
+                    case 0x30: xField.set(field.bitIdx, field.bitSize, true); break;
+                    case 0x31: yField.set(field.bitIdx, field.bitSize, true); break;
+                    case 0x38: wheelField.set(field.bitIdx, field.bitSize, true); break;
                     default: break;
                 }
                 break;
@@ -42,7 +26,7 @@ void HIDReportHandlerMouse::_addInputField(const HIDField &field) {
 
             case 9: {
                 if (field.bitSize == 1 && field.usageMin >= 1 && field.usageMin <= maxButtons) {
-                    buttons[field.usageMin - 1] = field.bitIdx;
+                    buttonMap.add(field.bitIdx, field.usageMin - 1);
                 }
                 break;
             }
@@ -52,6 +36,10 @@ void HIDReportHandlerMouse::_addInputField(const HIDField &field) {
     }
 }
 
+void HIDReportHandlerMouse::_compile() {
+    buttonMap.compile();
+}
+
 void HIDReportHandlerMouse::_inputReport(uint8_t reportId, const uint8_t *buf, size_t length) {
     // printf("HIDReportHandlerMouse::inputReport:");
     // for (unsigned i = 0; i < length; i++) {
@@ -61,25 +49,19 @@ void HIDReportHandlerMouse::_inputReport(uint8_t reportId, const uint8_t *buf, s
 
     //	HexDump(buf, length);
 
-    int     dx         = 0;
-    int     dy         = 0;
-    int     dWheel     = 0;
-    uint8_t buttonMask = 0;
-
-    if (xIdx >= 0)
-        dx = (int)readBits(buf, length, xIdx, xSize, true);
-    if (yIdx >= 0)
-        dy = (int)readBits(buf, length, yIdx, ySize, true);
-    if (wheelIdx >= 0)
-        dWheel = (int)readBits(buf, length, wheelIdx, wheelSize, true);
+    int     dx         = xField.read(buf, length);
+    int     dy         = yField.read(buf, length);
+    int     dWheel     = wheelField.read(buf, length);
+    uint8_t buttonMask = buttonMap.read(buf, length);
 
-    for (int i = 0; i < 3; i++) {
-        if (buttons[i] >= 0 && (int)readBits(buf, length, buttons[i], 1, false))
-            buttonMask |= (1 << i);
-    }
+    // Idle report
+    if (dx == 0 && dy == 0 && dWheel == 0 && buttonMask == prevButtonMask)
+        return;
+    prevButtonMask = buttonMask;
 
     auto core = FpgaCore::get();
     if (core) {
+        InputRecorder::instance()->event(InputEvent::Mouse, dx, dy, buttonMask);
         core->mouseReport(dx, dy, buttonMask, dWheel);
     }
 }
@@ -9,11 +9,12 @@ public:
 
 protected:
     void _addInputField(const HIDField &field) override;
+    void _compile() override;
     void _inputReport(uint8_t reportId, const uint8_t *buf, size_t length) override;
 
     static const int maxButtons = 3;
 
-    int buttons[maxButtons];
-    int xIdx, yIdx, wheelIdx;
-    int xSize, ySize, wheelSize;
+    HIDButtonMap buttonMap;
+    HIDBitField  xField, yField, wheelField;
+    uint8_t      prevButtonMask = 0xFF; // First report is always passed on
 };
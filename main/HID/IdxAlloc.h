@@ -1,33 +1,37 @@
+#pragma once
+
 #include "Common.h"
+#include <algorithm>
 #include <atomic>
 
+// Lock-free index allocator for up to 32 indexes
 class IdxAlloc {
 public:
-    uint8_t val;
+    IdxAlloc(unsigned _count = 32) : count(std::min(_count, 32U)) {}
 
     int alloc() {
-        vTaskSuspendAll();
+        uint32_t cur = val.load(std::memory_order_relaxed);
+        while (1) {
+            uint32_t avail = ~cur & mask();
+            if (avail == 0)
+                return -1;
 
-        int result = -1;
-        for (int i = 0; i < 8; i++) {
-            if ((val & (1 << i)) == 0) {
-                result = i;
-                val |= (1 << i);
-                break;
-            }
+            int      idx  = __builtin_ctz(avail);
+            uint32_t next = cur | (1U << idx);
+            if (val.compare_exchange_weak(cur, next, std::memory_order_acq_rel, std::memory_order_relaxed))
+                return idx;
         }
-
-        xTaskResumeAll();
-
-        return result;
     }
 
     void free(int idx) {
-        if (idx < 0 || idx > 7)
+        if (idx < 0 || idx >= (int)count)
             return;
-
-        vTaskSuspendAll();
-        val &= ~(1 << idx);
-        xTaskResumeAll();
+        val.fetch_and(~(1U << idx), std::memory_order_acq_rel);
     }
+
+private:
+    std::atomic<uint32_t> val{0};
+    const unsigned        count;
+
+    uint32_t mask() const { return count >= 32 ? 0xFFFFFFFF : ((1U << count) - 1); }
 };
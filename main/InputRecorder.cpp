@@ -0,0 +1,283 @@
+#include "InputRecorder.h"
+#include "HIDReportHandler.h"
+#include "Keyboard.h"
+#include "VFS.h"
+#include <algorithm>
+#include <atomic>
+
+static const char *TAG = "InputRecorder";
+
+#define REC_VERSION  (1)
+#define REC_MAX_SIZE (256 * 1024)
+
+struct __attribute__((packed)) RecFileHeader {
+    char     magic[4];
+    uint16_t version;
+    uint16_t reserved;
+};
+
+struct __attribute__((packed)) RecHeader {
+    uint8_t  type;
+    uint8_t  devIdx;
+    uint16_t length;
+    uint32_t timestamp;
+};
+
+class InputRecorderInt : public InputRecorder {
+public:
+    SemaphoreHandle_t         mutex;
+    std::atomic<bool>         recording{false};
+    std::atomic<bool>         full{false}; // Buffer full, recording stopped until saved or discarded
+    std::atomic<bool>         replaying{false};
+    int64_t                   startTime = 0;
+    std::vector<uint8_t>      data;
+    std::vector<const void *> devs; // Index is devIdx, nullptr when disconnected
+    unsigned                  eventCount = 0;
+    TaskHandle_t              replayTask = nullptr;
+
+    // Events decoded from the current report, logged after its CPU time is measured
+    struct LoggedEvent {
+        InputEvent type;
+        int        a, b, c;
+    };
+    std::vector<LoggedEvent> events;
+
+    InputRecorderInt() {
+        mutex = xSemaphoreCreateRecursiveMutex();
+    }
+
+    bool isRecording() override {
+        return recording;
+    }
+
+    bool hasRecording() override {
+        return recording || full;
+    }
+
+    void startRecording() override {
+        RecursiveMutexLock lock(mutex);
+
+        RecFileHeader hdr;
+        memcpy(hdr.magic, "AQIR", 4);
+        hdr.version  = REC_VERSION;
+        hdr.reserved = 0;
+
+        // Reserve the whole buffer up front (in PSRAM, given its size), so appending in
+        // the input callbacks never reallocates
+        data.clear();
+        data.reserve(REC_MAX_SIZE);
+        data.insert(data.end(), (const uint8_t *)&hdr, (const uint8_t *)&hdr + sizeof(hdr));
+        devs.clear();
+        full      = false;
+        startTime = esp_timer_get_time();
+        recording = true;
+    }
+
+    int stopRecording(const std::string &path) override {
+        RecursiveMutexLock lock(mutex);
+        recording = false;
+        full      = false;
+        devs.clear();
+
+        int result = 0;
+        if (!path.empty()) {
+            auto vfs = getSDCardVFS();
+            int  fd  = vfs->open(FO_WRONLY | FO_CREATE | FO_TRUNC, path);
+            if (fd < 0) {
+                result = fd;
+            } else {
+                int ret = vfs->write(fd, data.size(), data.data());
+                if (ret < 0)
+                    result = ret;
+                vfs->close(fd);
+            }
+            ESP_LOGI(TAG, "Saved %u bytes to %s: %d", (unsigned)data.size(), path.c_str(), result);
+        }
+
+        data.clear();
+        data.shrink_to_fit();
+        return result;
+    }
+
+    bool append(uint8_t type, uint8_t devIdx, int prefix, const void *buf, size_t length) {
+        size_t payloadLen = length + (prefix >= 0 ? 1 : 0);
+        if (payloadLen > UINT16_MAX)
+            return false;
+
+        if (data.size() + sizeof(RecHeader) + payloadLen > REC_MAX_SIZE) {
+            ESP_LOGW(TAG, "Recording buffer full, recording stopped");
+            recording = false;
+            full      = true;
+            return false;
+        }
+
+        RecHeader hdr;
+        hdr.type      = type;
+        hdr.devIdx    = devIdx;
+        hdr.length    = payloadLen;
+        hdr.timestamp = (uint32_t)(esp_timer_get_time() - startTime);
+
+        data.insert(data.end(), (const uint8_t *)&hdr, (const uint8_t *)&hdr + sizeof(hdr));
+        if (prefix >= 0)
+            data.push_back(prefix);
+        data.insert(data.end(), (const uint8_t *)buf, (const uint8_t *)buf + length);
+        return true;
+    }
+
+    void record(const void *dev, const std::vector<uint8_t> &reportDesc, int reportId, const void *buf, size_t length) override {
+        RecursiveMutexLock lock(mutex);
+        if (!recording)
+            return;
+
+        // Write descriptor on first report of device
+        unsigned devIdx = std::find(devs.begin(), devs.end(), dev) - devs.begin();
+        if (devIdx == devs.size()) {
+            if (devIdx > UINT8_MAX)
+                return;
+            devs.push_back(dev);
+
+            if (!append(REC_DESCRIPTOR, devIdx, -1, reportDesc.data(), reportDesc.size()))
+                return;
+        }
+
+        if (reportId < 0) {
+            append(REC_REPORT, devIdx, -1, buf, length);
+        } else {
+            append(REC_REPORT_WITH_ID, devIdx, reportId, buf, length);
+        }
+    }
+
+    void removeDevice(const void *dev) override {
+        RecursiveMutexLock lock(mutex);
+        std::replace(devs.begin(), devs.end(), dev, (const void *)nullptr);
+    }
+
+    int readFile(const std::string &path, std::vector<uint8_t> &buf) {
+        auto vfs = getSDCardVFS();
+        int  fd  = vfs->open(FO_RDONLY, path);
+        if (fd < 0)
+            return fd;
+
+        buf.clear();
+        uint8_t tmp[512];
+        while (1) {
+            int ret = vfs->read(fd, sizeof(tmp), tmp);
+            if (ret < 0) {
+                vfs->close(fd);
+                return ret;
+            }
+            if (ret == 0)
+                break;
+            buf.insert(buf.end(), tmp, tmp + ret);
+        }
+        vfs->close(fd);
+        return 0;
+    }
+
+    int replay(const std::string &path, ReplayStats &stats) override {
+        memset(&stats, 0, sizeof(stats));
+
+        std::vector<uint8_t> buf;
+        int                  ret = readFile(path, buf);
+        if (ret < 0)
+            return ret;
+
+        RecFileHeader fileHdr;
+        if (buf.size() < sizeof(fileHdr))
+            return ERR_PARAM;
+        memcpy(&fileHdr, buf.data(), sizeof(fileHdr));
+        if (memcmp(fileHdr.magic, "AQIR", 4) != 0 || fileHdr.version != REC_VERSION)
+            return ERR_PARAM;
+
+        std::map<uint8_t, HIDReportHandler *> handlers;
+        std::vector<uint32_t>                 costs;
+
+        eventCount = 0;
+        replayTask = xTaskGetCurrentTaskHandle();
+        events.clear();
+        events.reserve(64);
+        replaying = true;
+
+        int64_t start = esp_timer_get_time();
+        size_t  idx   = sizeof(fileHdr);
+        while (idx + sizeof(RecHeader) <= buf.size()) {
+            RecHeader hdr;
+            memcpy(&hdr, &buf[idx], sizeof(hdr));
+            idx += sizeof(hdr);
+            if (idx + hdr.length > buf.size())
+                break;
+
+            const uint8_t *p = &buf[idx];
+            idx += hdr.length;
+
+            if (hdr.type == REC_DESCRIPTOR) {
+                if (handlers[hdr.devIdx])
+                    delete handlers[hdr.devIdx];
+                handlers[hdr.devIdx] = HIDReportHandler::getReportHandlersForDescriptor(p, hdr.length, true);
+                continue;
+            }
+            if ((hdr.type != REC_REPORT && hdr.type != REC_REPORT_WITH_ID) || (hdr.type == REC_REPORT_WITH_ID && hdr.length < 1))
+                continue;
+
+            // Keep the original timing
+            int64_t delay = start + hdr.timestamp - esp_timer_get_time();
+            if (delay >= 1000)
+                vTaskDelay(pdMS_TO_TICKS(delay / 1000));
+
+            int64_t t0 = esp_timer_get_time();
+            for (auto handler = handlers[hdr.devIdx]; handler; handler = handler->next) {
+                if (hdr.type == REC_REPORT)
+                    handler->inputReport(p, hdr.length);
+                else
+                    handler->inputReport(p[0], p + 1, hdr.length - 1);
+            }
+            costs.push_back((uint32_t)(esp_timer_get_time() - t0));
+            logEvents();
+        }
+
+        // Releases any keys/buttons still held
+        for (auto &[devIdx, handler] : handlers) {
+            if (handler)
+                delete handler;
+        }
+        logEvents();
+        replaying = false;
+
+        stats.reports = costs.size();
+        stats.events  = eventCount;
+        if (!costs.empty()) {
+            std::sort(costs.begin(), costs.end());
+            stats.p50 = costs[costs.size() / 2];
+            stats.p99 = costs[std::min(costs.size() - 1, costs.size() * 99 / 100)];
+            stats.max = costs.back();
+        }
+        ESP_LOGI(
+            TAG, "Replayed %u reports, %u events, CPU per report: p50 %uus p99 %uus max %uus",
+            stats.reports, stats.events, stats.p50, stats.p99, stats.max);
+        return 0;
+    }
+
+    void event(InputEvent type, int a, int b, int c) override {
+        // Only events caused by the replay, not by devices in use meanwhile
+        if (!replaying || xTaskGetCurrentTaskHandle() != replayTask)
+            return;
+        eventCount++;
+        events.push_back(LoggedEvent{type, a, b, c});
+    }
+
+    void logEvents() {
+        for (auto &ev : events) {
+            switch (ev.type) {
+                case InputEvent::Key: ESP_LOGI(TAG, "Key %s %s", getScanCodeName((uint8_t)ev.a), ev.b ? "down" : "up"); break;
+                case InputEvent::Mouse: ESP_LOGI(TAG, "Mouse dx=%d dy=%d buttons=%02X", ev.a, ev.b, ev.c); break;
+                case InputEvent::Gamepad: ESP_LOGI(TAG, "Gamepad %d buttons=%04X", ev.a, ev.b); break;
+            }
+        }
+        events.clear();
+    }
+};
+
+InputRecorder *InputRecorder::instance() {
+    static InputRecorderInt obj;
+    return &obj;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Common.h"
+
+// Recording file format (little endian):
+//   File header: 'AQIR', u16 version, u16 reserved
+//   Records:     u8 type, u8 devIdx, u16 length, u32 timestamp (us since start), payload
+//
+// A descriptor record is written the first time a device reports, devIdx is
+// assigned per connection. Reports from USB include the report ID (if any),
+// reports from Bluetooth are prefixed with the report ID from the report
+// reference descriptor.
+enum {
+    REC_DESCRIPTOR     = 1, // HID report descriptor
+    REC_REPORT         = 2, // Input report, report ID in-band
+    REC_REPORT_WITH_ID = 3, // u8 report ID followed by input report
+};
+
+// Decoded input event passed to the FPGA core
+enum class InputEvent {
+    Key,     // a: scancode, b: key down
+    Mouse,   // a: dx, b: dy, c: buttons
+    Gamepad, // a: gamepad index, b: buttons
+};
+
+class InputRecorder {
+public:
+    static InputRecorder *instance();
+
+    // Recording of raw input reports, 'dev' identifies the device while connected.
+    // reportId < 0 means the report ID (if any) is part of the report data.
+    virtual bool isRecording()                                                                                                 = 0;
+    virtual bool hasRecording()                                                                                                = 0; // Recording, or stopped when full and not saved yet
+    virtual void startRecording()                                                                                              = 0;
+    virtual int  stopRecording(const std::string &path)                                                                        = 0; // Empty path discards recording
+    virtual void record(const void *dev, const std::vector<uint8_t> &reportDesc, int reportId, const void *buf, size_t length) = 0;
+    virtual void removeDevice(const void *dev)                                                                                 = 0;
+
+    // Replay recording through the HID report handlers, keyboard and current core
+    struct ReplayStats {
+        unsigned reports;
+        unsigned events;
+        unsigned p50; // CPU time per report in us
+        unsigned p99;
+        unsigned max;
+    };
+    virtual int replay(const std::string &path, ReplayStats &stats) = 0;
+
+    // Decoded event, logged while replaying
+    virtual void event(InputEvent type, int a, int b, int c = 0) = 0;
+};
@@ -2,6 +2,8 @@
 #include "FPGA.h"
 #include "FpgaCore.h"
 #include "DisplayOverlay/DisplayOverlay.h"
+#include "LatencyTrace.h"
+#include "InputRecorder.h"
 #include "USBHost.h"
 
 static const char *TAG = "Keyboard";
@@ -219,10 +221,13 @@ public:
     uint8_t           leds                 = 0;
     uint8_t           composeFirst         = 0;
     bool              enableAqPlusMappings = true;
+    unsigned          batchDepth           = 0;
+
+    std::shared_ptr<FpgaCore> batchCore; // Core receiving the current key batch
 
     KeyboardInt() {
         mutex         = xSemaphoreCreateRecursiveMutex();
-        keyQueue      = xQueueCreate(128, 1);
+        keyQueue      = xQueueCreate(128, sizeof(uint16_t));
         scanCodeQueue = xQueueCreate(1, 1);
 
         auto timer = xTimerCreate("keyRepeat", pdMS_TO_TICKS(16), pdTRUE, this, _keyRepeatTimer);
@@ -240,7 +245,7 @@ public:
 
         pressCounter++;
         if (pressCounter > 30 && pressCounter % 3 == 0) {
-            xQueueSend(keyQueue, &repeat, 0);
+            postEvent(repeat);
 
             if (!getDisplayOverlay()->isVisible()) {
                 auto core = FpgaCore::get();
@@ -305,6 +310,7 @@ public:
         bool leftFn  = (keys & (1ULL << 17)) != 0;
         bool rightFn = (keys & (1ULL << 52)) != 0;
 
+        beginBatch();
         if (releasedKeys) {
             for (unsigned i = 0; i < 54; i++) {
                 if (releasedKeys & (1ULL << i)) {
@@ -328,9 +334,30 @@ public:
                 }
             }
         }
+        endBatch();
     }
 #endif
 
+    void beginBatch() override {
+        RecursiveMutexLock lock(mutex);
+        if (batchDepth++ == 0) {
+            batchCore = FpgaCore::get();
+            if (batchCore)
+                batchCore->keyBatchBegin();
+        }
+    }
+
+    void endBatch() override {
+        RecursiveMutexLock lock(mutex);
+        if (batchDepth == 0)
+            return;
+        if (--batchDepth == 0) {
+            if (batchCore)
+                batchCore->keyBatchEnd();
+            batchCore.reset();
+        }
+    }
+
     void reset(bool _enableAqPlusMappings) override {
         RecursiveMutexLock lock(mutex);
         modifiers            = 0;
@@ -342,6 +369,7 @@ public:
 
     void handleScancode(unsigned scanCode, bool keyDown) override {
         RecursiveMutexLock lock(mutex);
+        LatencyTrace::instance()->mark(TracePoint::Keyboard);
         repeat       = 0;
         pressCounter = 0;
         if (keyDown) {
@@ -355,6 +383,8 @@ public:
         bool stopProcessing = false;
         auto core           = FpgaCore::get();
         if (core && (!getDisplayOverlay()->isVisible() || !keyDown)) {
+            LatencyTrace::instance()->mark(TracePoint::Core);
+            InputRecorder::instance()->event(InputEvent::Key, scanCode, keyDown);
             stopProcessing = core->keyScancode(modifiers, scanCode, keyDown);
         }
 
@@ -367,7 +397,7 @@ public:
                         core->keyChar(ch, false, modifiers);
                 }
             }
-            xQueueSend(keyQueue, &ch, 0);
+            postEvent(ch);
         }
     }
 
@@ -628,8 +658,12 @@ public:
         return result;
     }
 
+    void postEvent(uint16_t event) override {
+        xQueueSend(keyQueue, &event, 0);
+    }
+
     int getKey(TickType_t ticksToWait) override {
-        uint8_t result;
+        uint16_t result;
         if (!xQueueReceive(keyQueue, &result, ticksToWait))
             return -1;
         return result;
@@ -19,10 +19,18 @@ public:
 #endif
     virtual void handleScancode(unsigned scanCode, bool keyDown) = 0;
 
+    // Scancodes handled between beginBatch and endBatch are applied to the
+    // core's key matrix as a single update
+    virtual void beginBatch() = 0;
+    virtual void endBatch()   = 0;
+
     virtual void reset(bool enableAqPlusMappings = true) = 0;
     virtual int  getKey(TickType_t ticksToWait)       = 0;
     virtual int  waitScanCode()                       = 0;
 
+    // Queue an event for getKey(), values >= 0x100 are never generated by keys
+    virtual void postEvent(uint16_t event) = 0;
+
     virtual void        setKeyLayout(KeyLayout layout)     = 0;
     virtual KeyLayout   getKeyLayout()                     = 0;
     virtual std::string getKeyLayoutName(KeyLayout layout) = 0;
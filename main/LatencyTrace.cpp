@@ -0,0 +1,72 @@
+#include "LatencyTrace.h"
+#include <algorithm>
+#include <atomic>
+
+static thread_local int64_t  reportStart;
+static thread_local unsigned reportMarks;
+
+class LatencyTraceInt : public LatencyTrace {
+public:
+    static const unsigned ringSize = 256;
+
+    // Lock-free sample ring per trace point, writers claim a slot with fetch_add
+    struct Ring {
+        std::atomic<unsigned> writeIdx;
+        uint32_t              samples[ringSize];
+    };
+    Ring rings[(int)TracePoint::Count];
+
+    void begin() override {
+        reportStart = esp_timer_get_time();
+        reportMarks = 0;
+    }
+
+    void end() override {
+        reportStart = 0;
+    }
+
+    void mark(TracePoint point) override {
+        if (reportStart == 0 || (reportMarks & (1 << (int)point)))
+            return;
+        reportMarks |= (1 << (int)point);
+
+        auto    &ring  = rings[(int)point];
+        unsigned idx   = ring.writeIdx.fetch_add(1, std::memory_order_relaxed);
+        uint32_t value = (uint32_t)std::min(esp_timer_get_time() - reportStart, (int64_t)UINT32_MAX);
+
+        ring.samples[idx % ringSize] = value;
+    }
+
+    Stats getStats(TracePoint point) override {
+        auto &ring  = rings[(int)point];
+        auto  count = std::min(ring.writeIdx.load(std::memory_order_relaxed), ringSize);
+
+        Stats result = {};
+        if (count == 0)
+            return result;
+
+        uint32_t sorted[ringSize];
+        memcpy(sorted, ring.samples, count * sizeof(sorted[0]));
+        std::sort(sorted, sorted + count);
+
+        result.count = count;
+        result.p50   = sorted[count / 2];
+        result.p99   = sorted[std::min(count - 1, count * 99 / 100)];
+        result.max   = sorted[count - 1];
+        return result;
+    }
+
+    const char *getName(TracePoint point) override {
+        switch (point) {
+            case TracePoint::Keyboard: return "Keyboard";
+            case TracePoint::Core: return "Core";
+            case TracePoint::Fpga: return "FPGA";
+            default: return "";
+        }
+    }
+};
+
+LatencyTrace *LatencyTrace::instance() {
+    static LatencyTraceInt obj;
+    return &obj;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "Common.h"
+
+// Trace points along the input pipeline, latency is measured from the moment
+// the report was received from USB/Bluetooth.
+enum class TracePoint {
+    Keyboard, // Scancode handled by keyboard
+    Core,     // Key/gamepad event passed to FPGA core
+    Fpga,     // First resulting FPGA command queued
+    Count,
+};
+
+class LatencyTrace {
+public:
+    static LatencyTrace *instance();
+
+    // Called around processing of a single input report (per task)
+    virtual void begin() = 0;
+    virtual void end()   = 0;
+
+    // Record latency of trace point, only the first mark per report is recorded
+    virtual void mark(TracePoint point) = 0;
+
+    struct Stats {
+        unsigned count; // Number of samples (at most the ring size)
+        unsigned p50;   // Latencies in us
+        unsigned p99;
+        unsigned max;
+    };
+    virtual Stats       getStats(TracePoint point) = 0;
+    virtual const char *getName(TracePoint point)  = 0;
+};
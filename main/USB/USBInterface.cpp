@@ -1,4 +1,5 @@
 #include "USBInterface.h"
+#include "USBDevice.h"
 
 static const char *TAG = "USBInterface";
 
@@ -7,6 +8,22 @@ USBInterface::USBInterface(USBDevice *_device)
 }
 
 USBInterface::~USBInterface() {
+    if (inEpAddr) {
+        ESP_LOGI(
+            TAG, "EP 0x%02X: completed: %u NAK timeouts: %u errors: %u late: %u missed: %u",
+            inEpAddr, completed, nakTimeouts, errors, late, missed);
+    }
+}
+
+bool USBInterface::startInTransfers(uint8_t epAddr, size_t length, unsigned count) {
+    // Pre-allocated transfers are recycled by _inTransferCb
+    inEpAddr = epAddr;
+    for (unsigned i = 0; i < count; i++) {
+        if (!device->transferIn(epAddr, length, _inTransferCb, this))
+            break;
+        inFlight++;
+    }
+    return inFlight > 0;
 }
 
 void USBInterface::_inTransferCb(usb_transfer_t *transfer) {
@@ -15,10 +32,26 @@ void USBInterface::_inTransferCb(usb_transfer_t *transfer) {
         ESP_LOGI(TAG, "inTransferCb - no device");
         usb_host_transfer_free(transfer);
         return;
-    } else if (transfer->status == USB_TRANSFER_STATUS_COMPLETED) {
-        static_cast<USBInterface *>(transfer->context)->processInData(transfer->data_buffer, transfer->actual_num_bytes);
     }
 
-    // Retransmit transfer to get next data
-    usb_host_transfer_submit(transfer);
+    auto interface = static_cast<USBInterface *>(transfer->context);
+    if (--interface->inFlight == 0)
+        interface->late++;
+
+    switch (transfer->status) {
+        case USB_TRANSFER_STATUS_COMPLETED:
+            interface->completed++;
+            interface->processInData(transfer->data_buffer, transfer->actual_num_bytes);
+            break;
+        case USB_TRANSFER_STATUS_TIMED_OUT: interface->nakTimeouts++; break;
+        default: interface->errors++; break;
+    }
+
+    // Resubmit transfer to get next data
+    if (usb_host_transfer_submit(transfer) != ESP_OK) {
+        interface->missed++;
+        usb_host_transfer_free(transfer);
+        return;
+    }
+    interface->inFlight++;
 }
@@ -13,6 +13,7 @@ public:
     USBInterface *nextInterface = nullptr;
 
 protected:
+    bool         startInTransfers(uint8_t epAddr, size_t length, unsigned count = CONFIG_USB_IN_TRANSFERS);
     static void  _inTransferCb(usb_transfer_t *transfer);
     virtual void processInData(const uint8_t *buf, size_t length) = 0;
 
@@ -20,4 +21,13 @@ protected:
     uint8_t    bInterfaceNumber  = 0;
     uint8_t    bAlternateSetting = 0;
     bool       ifClaimed         = false;
+
+    // IN endpoint statistics
+    uint8_t  inEpAddr    = 0;
+    unsigned inFlight    = 0; // Transfers currently submitted
+    unsigned completed   = 0; // Transfers completed with data
+    unsigned nakTimeouts = 0; // Device kept NAKing until the transfer timed out
+    unsigned errors      = 0; // Error, stall, overflow or skipped transfers
+    unsigned late        = 0; // Completions that left no transfer in flight until resubmitted
+    unsigned missed      = 0; // Transfers that could not be resubmitted
 };
@@ -5,6 +5,8 @@
 #include "HIDReportHandlerKeyboard.h"
 #include "HIDReportHandlerMouse.h"
 #include "HIDReportHandlerGamepad.h"
+#include "LatencyTrace.h"
+#include "InputRecorder.h"
 
 static const char *TAG = "USBInterfaceHID";
 
@@ -13,6 +15,7 @@ USBInterfaceHID::USBInterfaceHID(USBDevice *device)
 }
 
 USBInterfaceHID::~USBInterfaceHID() {
+    InputRecorder::instance()->removeDevice(this);
     {
         RecursiveMutexLock lock(mutex);
         if (reportHandlers) {
@@ -63,18 +66,16 @@ bool USBInterfaceHID::init(const void *ifDesc, size_t ifDescLen) {
 
     ESP_LOGI(TAG, "- Interrupt endpoint %u maxPacketSize: %u interval: %u", endpointAddr, maxPacketSize, interval);
 
-    uint8_t *reportDescBuf = new uint8_t[reportDescLen];
-    if (reportDescBuf == nullptr)
-        return false;
+    // Report descriptor is kept for input recording
+    reportDesc.resize(reportDescLen);
 
     bool result = device->controlTransfer(
         USB_ENDPOINT_IN | USB_RECIPIENT_INTERFACE, USB_REQUEST_GET_DESCRIPTOR,
-        (0x22 << 8) | 0, bInterfaceNumber, reportDescBuf, reportDescLen);
+        (0x22 << 8) | 0, bInterfaceNumber, reportDesc.data(), reportDescLen);
 
     ESP_LOGI(TAG, "result: %d", result);
 
-    reportHandlers = HIDReportHandler::getReportHandlersForDescriptor(reportDescBuf, reportDescLen);
-    delete[] reportDescBuf;
+    reportHandlers = HIDReportHandler::getReportHandlersForDescriptor(reportDesc.data(), reportDescLen);
 
     // At least one data handler for this interface?
     if (reportHandlers) {
@@ -87,7 +88,7 @@ bool USBInterfaceHID::init(const void *ifDesc, size_t ifDescLen) {
         size_t transferSize = (maxPacketSize + 3) & ~3;
 
         ESP_LOGI(TAG, "Starting transfer on EP 0x%02X size: %u", endpointAddr, transferSize);
-        device->transferIn(endpointAddr, transferSize, _inTransferCb, this);
+        startInTransfers(endpointAddr, transferSize);
 
         // if (_isKeyboard) {
         //     device->setLeds(0);
@@ -102,9 +103,18 @@ void USBInterfaceHID::processInData(const uint8_t *buf, size_t length) {
 
     // ESP_LOG_BUFFER_HEXDUMP(TAG, transfer->data_buffer, transfer->actual_num_bytes, ESP_LOG_INFO);
 
+    auto trace = LatencyTrace::instance();
+    trace->begin();
+
+    auto recorder = InputRecorder::instance();
+    if (recorder->isRecording())
+        recorder->record(this, reportDesc, -1, buf, length);
+
     HIDReportHandler *reportHandler = reportHandlers;
     while (reportHandler) {
         reportHandler->inputReport(buf, length);
         reportHandler = reportHandler->next;
     }
+
+    trace->end();
 }
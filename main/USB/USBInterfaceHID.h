@@ -34,5 +34,7 @@ protected:
     bool              _isKeyboard    = false;
     HIDReportHandler *reportHandlers = nullptr;
 
+    std::vector<uint8_t> reportDesc;
+
     void processInData(const uint8_t *buf, size_t length) override;
 };
@@ -60,7 +60,7 @@ bool USBInterfaceMIDI::init(const void *ifDesc, size_t ifDescLen) {
         return false;
 
     ESP_LOGI(TAG, "Starting transfer on EP 0x%02X size: %u", endpointAddr, maxPacketSize);
-    device->transferIn(endpointAddr, maxPacketSize, _inTransferCb, this);
+    startInTransfers(endpointAddr, maxPacketSize);
 
     return true;
 }
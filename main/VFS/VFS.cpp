@@ -461,6 +461,45 @@ std::pair<int, std::vector<uint8_t>> VFSContext::readFile(const std::string &pat
     return {0, data};
 }
 
+int VFSContext::readFileChunked(const std::string &pathArg, size_t chunkSize, ChunkConsumer consumer, size_t *fileSize) {
+    // Compose full path
+    VFS *vfs  = nullptr;
+    auto path = resolvePath(pathArg, &vfs);
+    if (!vfs || chunkSize == 0)
+        return ERR_PARAM;
+
+    struct stat st;
+    int         res = vfs->stat(path, &st);
+    if (res < 0)
+        return res;
+    if ((st.st_mode & S_IFREG) == 0)
+        return ERR_NOT_FOUND;
+    if (fileSize)
+        *fileSize = st.st_size;
+
+    auto buf = std::make_unique<uint8_t[]>(chunkSize);
+
+    int fd = vfs->open(FO_RDONLY, path);
+    if (fd < 0)
+        return fd;
+
+    while (1) {
+        int size = vfs->read(fd, chunkSize, buf.get());
+        if (size < 0) {
+            res = size;
+            break;
+        }
+        if (size == 0)
+            break;
+        if (!consumer(buf.get(), size)) {
+            res = ERR_OTHER;
+            break;
+        }
+    }
+    vfs->close(fd);
+    return res;
+}
+
 VFSContext *VFSContext::getDefault() {
     static VFSContext obj;
     return &obj;
@@ -139,6 +139,11 @@ public:
 
     std::pair<int, std::vector<uint8_t>> readFile(const std::string &path, bool zeroTerminate = false);
 
+    // Read file in chunks of at most chunkSize bytes, passing each chunk to the consumer.
+    // Reading stops with ERR_OTHER when the consumer returns false.
+    using ChunkConsumer = std::function<bool(const void *buf, size_t length)>;
+    int readFileChunked(const std::string &path, size_t chunkSize, ChunkConsumer consumer, size_t *fileSize = nullptr);
+
 private:
     std::string resolvePath(std::string path, VFS **vfs, std::string *wildCard = nullptr);
 
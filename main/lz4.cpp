@@ -0,0 +1,250 @@
+#include "lz4.h"
+#include <algorithm>
+
+static const char *TAG = "lz4";
+
+#define LZ4_MAGIC          (0x184D2204)
+#define LZ4_MAX_BLOCK_SIZE (65536)
+
+enum {
+    FLG_DICT_ID          = (1 << 0),
+    FLG_CONTENT_CHECKSUM = (1 << 2),
+    FLG_CONTENT_SIZE     = (1 << 3),
+    FLG_BLOCK_CHECKSUM   = (1 << 4),
+    FLG_BLOCK_INDEP      = (1 << 5),
+};
+
+static inline uint32_t getLe32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Decode a single LZ4 block, returns the decoded size or -1 on corrupt data
+static int decodeBlock(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstSize) {
+    const uint8_t *ip    = src;
+    const uint8_t *ipEnd = src + srcSize;
+    uint8_t       *op    = dst;
+    uint8_t       *opEnd = dst + dstSize;
+
+    while (ip < ipEnd) {
+        unsigned token = *ip++;
+
+        // Literals
+        size_t litLen = token >> 4;
+        if (litLen == 15) {
+            uint8_t val;
+            do {
+                if (ip >= ipEnd)
+                    return -1;
+                val = *ip++;
+                litLen += val;
+            } while (val == 255);
+        }
+        if (litLen > (size_t)(ipEnd - ip) || litLen > (size_t)(opEnd - op))
+            return -1;
+        memcpy(op, ip, litLen);
+        ip += litLen;
+        op += litLen;
+
+        // Last sequence only contains literals
+        if (ip >= ipEnd)
+            break;
+
+        // Match
+        if (ipEnd - ip < 2)
+            return -1;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst))
+            return -1;
+
+        size_t matchLen = token & 15;
+        if (matchLen == 15) {
+            uint8_t val;
+            do {
+                if (ip >= ipEnd)
+                    return -1;
+                val = *ip++;
+                matchLen += val;
+            } while (val == 255);
+        }
+        matchLen += 4;
+        if (matchLen > (size_t)(opEnd - op))
+            return -1;
+
+        const uint8_t *match = op - offset;
+        if (offset >= matchLen) {
+            memcpy(op, match, matchLen);
+            op += matchLen;
+        } else {
+            // Overlapping copy
+            while (matchLen--)
+                *op++ = *match++;
+        }
+    }
+    return (int)(op - dst);
+}
+
+Lz4Decoder::Lz4Decoder(Output _output)
+    : output(_output) {
+}
+
+Lz4Decoder::~Lz4Decoder() {
+    free(inBuf);
+    free(outBuf);
+}
+
+bool Lz4Decoder::isLz4(const void *data, size_t length) {
+    return length >= 4 && getLe32((const uint8_t *)data) == LZ4_MAGIC;
+}
+
+bool Lz4Decoder::getContentSize(const void *data, size_t length, uint64_t *size) {
+    // Magic, FLG, BD, optional 64-bit content size
+    const uint8_t *p = (const uint8_t *)data;
+    if (!isLz4(data, length) || length < 14 || (p[4] & FLG_CONTENT_SIZE) == 0)
+        return false;
+
+    *size = (uint64_t)getLe32(p + 6) | ((uint64_t)getLe32(p + 10) << 32);
+    return true;
+}
+
+bool Lz4Decoder::write(const void *data, size_t length) {
+    const uint8_t *p = (const uint8_t *)data;
+    while (length > 0) {
+        if (state == State::Done) {
+            // Ignore trailing data
+            return true;
+        }
+        if (state == State::Error)
+            return false;
+
+        uint8_t *dst  = (state == State::BlockData) ? inBuf : tmp;
+        size_t   size = std::min(length, need - level);
+        memcpy(dst + level, p, size);
+        level += size;
+        p += size;
+        length -= size;
+
+        if (level == need) {
+            level = 0;
+            if (!advance()) {
+                state = State::Error;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool Lz4Decoder::advance() {
+    switch (state) {
+        case State::Header: {
+            if (getLe32(tmp) != LZ4_MAGIC) {
+                ESP_LOGE(TAG, "Invalid frame magic");
+                return false;
+            }
+            flags = tmp[4];
+            if ((flags >> 6) != 1 || (flags & FLG_DICT_ID)) {
+                ESP_LOGE(TAG, "Unsupported frame flags: %02X", flags);
+                return false;
+            }
+            if ((flags & FLG_BLOCK_INDEP) == 0) {
+                ESP_LOGE(TAG, "Linked blocks not supported");
+                return false;
+            }
+            blockMaxSize = 1 << (2 * ((tmp[5] >> 4) & 7) + 8);
+            if (blockMaxSize > LZ4_MAX_BLOCK_SIZE) {
+                ESP_LOGE(TAG, "Block size %u too large (compress with -B4)", (unsigned)blockMaxSize);
+                return false;
+            }
+
+            inBuf  = (uint8_t *)malloc(blockMaxSize);
+            outBuf = (uint8_t *)malloc(blockMaxSize);
+            if (!inBuf || !outBuf) {
+                ESP_LOGE(TAG, "Insufficient memory for block buffers");
+                return false;
+            }
+
+            // Optional content size and header checksum
+            state = State::HeaderRest;
+            need  = ((flags & FLG_CONTENT_SIZE) ? 8 : 0) + 1;
+            return true;
+        }
+
+        case State::HeaderRest: {
+            state = State::BlockSize;
+            need  = 4;
+            return true;
+        }
+
+        case State::BlockSize: {
+            uint32_t val = getLe32(tmp);
+            if (val == 0) {
+                // End mark
+                if (flags & FLG_CONTENT_CHECKSUM) {
+                    state = State::ContentChecksum;
+                    need  = 4;
+                } else {
+                    state = State::Done;
+                }
+                return true;
+            }
+            blockRaw  = (val & 0x80000000) != 0;
+            blockSize = val & 0x7FFFFFFF;
+            if (blockSize > blockMaxSize) {
+                ESP_LOGE(TAG, "Invalid block size: %u", (unsigned)blockSize);
+                return false;
+            }
+            state = State::BlockData;
+            need  = blockSize;
+            return true;
+        }
+
+        case State::BlockData: {
+            if (blockRaw) {
+                if (!output(inBuf, blockSize))
+                    return false;
+                outputSize += blockSize;
+
+            } else {
+                int size = decodeBlock(inBuf, blockSize, outBuf, blockMaxSize);
+                if (size < 0) {
+                    ESP_LOGE(TAG, "Corrupt block data");
+                    return false;
+                }
+                if (!output(outBuf, size))
+                    return false;
+                outputSize += size;
+            }
+
+            if (flags & FLG_BLOCK_CHECKSUM) {
+                state = State::BlockChecksum;
+            } else {
+                state = State::BlockSize;
+            }
+            need = 4;
+            return true;
+        }
+
+        case State::BlockChecksum: {
+            // Checksums aren't verified, the FPGA checks the bitstream CRC itself
+            state = State::BlockSize;
+            need  = 4;
+            return true;
+        }
+
+        case State::ContentChecksum: {
+            state = State::Done;
+            return true;
+        }
+
+        default: return false;
+    }
+}
+
+bool Lz4Decoder::finish() {
+    if (state != State::Done) {
+        ESP_LOGE(TAG, "Incomplete frame");
+        return false;
+    }
+    return true;
+}
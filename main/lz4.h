@@ -0,0 +1,48 @@
+#pragma once
+
+#include "Common.h"
+
+// Streaming decoder for LZ4 frames (as produced by 'lz4 -B4').
+// Only independent blocks of up to 64KB are supported, so memory use is
+// bounded by the block size regardless of the size of the decompressed data.
+class Lz4Decoder {
+public:
+    using Output = std::function<bool(const void *buf, size_t length)>;
+
+    Lz4Decoder(Output output);
+    ~Lz4Decoder();
+
+    static bool isLz4(const void *data, size_t length);
+    static bool getContentSize(const void *data, size_t length, uint64_t *size); // Only if stored in the frame header
+
+    bool   write(const void *data, size_t length);
+    bool   finish();
+    size_t getOutputSize() { return outputSize; }
+
+private:
+    enum class State {
+        Header,
+        HeaderRest,
+        BlockSize,
+        BlockData,
+        BlockChecksum,
+        ContentChecksum,
+        Done,
+        Error,
+    };
+
+    bool advance();
+
+    Output   output;
+    uint8_t  tmp[16];
+    State    state        = State::Header;
+    uint8_t  flags        = 0;
+    size_t   need         = 6;
+    size_t   level        = 0;
+    uint32_t blockSize    = 0;
+    bool     blockRaw     = false;
+    size_t   blockMaxSize = 0;
+    uint8_t *inBuf        = nullptr;
+    uint8_t *outBuf       = nullptr;
+    size_t   outputSize   = 0;
+};